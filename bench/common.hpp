@@ -0,0 +1,30 @@
+#pragma once
+
+#include "io_engine.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <string>
+#include <utility>
+
+namespace bench {
+
+inline constexpr std::pair<const char *, coro::io_engine::backend> backends[] =
+    {
+        {"poll", coro::io_engine::backend::poll},
+        {"epoll", coro::io_engine::backend::epoll},
+        {"io_uring", coro::io_engine::backend::io_uring},
+};
+
+// register fn as <name>/<backend> for every backend, configure is applied to
+// each of them (arguments, units...)
+template <typename Fn, typename Configure>
+bool register_backends(const char *name, Fn fn, Configure configure) {
+  for (auto [backend, kind] : backends)
+    configure(benchmark::RegisterBenchmark(
+        (std::string(name) + "/" + backend).c_str(),
+        [fn, kind](benchmark::State &state) { fn(state, kind); }));
+  return true;
+}
+
+} // namespace bench
@@ -0,0 +1,360 @@
+#include "common.hpp"
+#include "io_engine_impl.hpp"
+
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+using namespace coro;
+
+namespace {
+
+// everything fixed at compile time, the others take the backend at runtime
+using static_epoll_engine =
+    basic_io_engine<static_backend<io_backend::epoll>, detail::timer_heap,
+                    detail::no_metrics>;
+
+void put(const utils::handle &fd) {
+  std::uint64_t value = 1;
+  [[maybe_unused]] auto n = ::write(static_cast<int>(fd), &value, sizeof(value));
+}
+
+void take(const utils::handle &fd) {
+  std::uint64_t value;
+  [[maybe_unused]] auto n = ::read(static_cast<int>(fd), &value, sizeof(value));
+}
+
+// send a byte back and forth over a socketpair, both sides wait for it with
+// poll (one item is one round trip)
+template <typename Engine = io_engine>
+void ping_pong(benchmark::State &state, io_engine::backend kind) {
+  Engine engine(kind);
+
+  int fds[2];
+  if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) == -1) {
+    state.SkipWithError("socketpair failed");
+    return;
+  }
+  utils::handle a(fds[0]), b(fds[1]);
+  auto rounds = static_cast<std::size_t>(state.range(0));
+
+  auto side = [&](const utils::handle &fd, bool first) -> eager_task<void> {
+    for (std::size_t i = 0; i < rounds; ++i) {
+      if (first)
+        put(fd);
+
+      co_await engine.poll(fd, POLLIN);
+      take(fd);
+
+      if (!first)
+        put(fd);
+    }
+  };
+
+  for (auto _ : state) {
+    auto pong = side(b, false);
+    auto ping = side(a, true);
+    engine.pull_all();
+  }
+
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// ping_pong at priority range(0) while range(1) bulk coroutines keep
+// rescheduling themselves: the flood takes only its share of each pull
+void ping_pong_under_flood(benchmark::State &state, io_engine::backend kind) {
+  io_engine engine(kind);
+
+  int fds[2];
+  if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) == -1) {
+    state.SkipWithError("socketpair failed");
+    return;
+  }
+  utils::handle a(fds[0]), b(fds[1]);
+  auto lane = static_cast<priority>(state.range(0));
+  auto flooders = static_cast<std::size_t>(state.range(1));
+  constexpr std::size_t rounds = 100;
+
+  bool done = false;
+  auto side = [&](const utils::handle &fd, bool first) -> eager_task<void> {
+    co_await set_priority(lane);
+    for (std::size_t i = 0; i < rounds; ++i) {
+      if (first)
+        put(fd);
+
+      co_await engine.poll(fd, POLLIN);
+      take(fd);
+
+      if (!first)
+        put(fd);
+    }
+    done = true;
+  };
+  auto flood = [&]() -> eager_task<void> {
+    co_await set_priority(priority::bulk);
+    while (!done)
+      co_await engine.schedule();
+  };
+
+  std::vector<eager_task<void>> bulk;
+  bulk.reserve(flooders);
+  for (auto _ : state) {
+    done = false;
+    for (std::size_t i = 0; i < flooders; ++i)
+      bulk.push_back(flood());
+    auto pong = side(b, false);
+    auto ping = side(a, true);
+    engine.pull_all();
+    bulk.clear();
+  }
+
+  state.SetItemsProcessed(state.iterations() * rounds);
+}
+
+// ping_pong where each side has a reader waiting for POLLIN and a writer
+// waiting for POLLOUT on the same fd (one registration per fd)
+void duplex_ping_pong(benchmark::State &state, io_engine::backend kind) {
+  io_engine engine(kind);
+
+  int fds[2];
+  if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) == -1) {
+    state.SkipWithError("socketpair failed");
+    return;
+  }
+  utils::handle a(fds[0]), b(fds[1]);
+  auto rounds = static_cast<std::size_t>(state.range(0));
+
+  // the writer of a side sends once its reader got the previous round
+  struct side_state {
+    std::size_t received = 0;
+    std::size_t sent = 0;
+  };
+  auto reader = [&](const utils::handle &fd,
+                    side_state &side) -> eager_task<void> {
+    while (side.received < rounds) {
+      co_await engine.poll(fd, POLLIN);
+      take(fd);
+      ++side.received;
+    }
+  };
+  auto writer = [&](const utils::handle &fd, side_state &side,
+                    bool first) -> eager_task<void> {
+    while (side.sent < rounds) {
+      if (side.sent + !first > side.received) {
+        co_await engine.schedule();
+        continue;
+      }
+
+      co_await engine.poll(fd, POLLOUT);
+      put(fd);
+      ++side.sent;
+    }
+  };
+
+  for (auto _ : state) {
+    side_state first, second;
+    auto read_a = reader(a, first);
+    auto read_b = reader(b, second);
+    auto write_b = writer(b, second, false);
+    auto write_a = writer(a, first, true);
+    engine.pull_all();
+  }
+
+  state.SetItemsProcessed(state.iterations() * rounds);
+}
+
+// ping_pong with both sides waiting on a readiness_stream (the fds stay
+// registered between round trips)
+void stream_ping_pong(benchmark::State &state, io_engine::backend kind) {
+  io_engine engine(kind);
+
+  int fds[2];
+  if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) == -1) {
+    state.SkipWithError("socketpair failed");
+    return;
+  }
+  utils::handle a(fds[0]), b(fds[1]);
+  auto rounds = static_cast<std::size_t>(state.range(0));
+  auto a_events = engine.readiness(a, POLLIN);
+  auto b_events = engine.readiness(b, POLLIN);
+
+  auto side = [&](const utils::handle &fd, io_engine::readiness_stream &events,
+                  bool first) -> eager_task<void> {
+    for (std::size_t i = 0; i < rounds; ++i) {
+      if (first)
+        put(fd);
+
+      co_await events.next();
+      take(fd);
+
+      if (!first)
+        put(fd);
+    }
+  };
+
+  for (auto _ : state) {
+    auto pong = side(b, b_events, false);
+    auto ping = side(a, a_events, true);
+    engine.pull_all();
+  }
+
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// many coroutines waiting for deadlines spread over a millisecond (one item is
+// one timer), with a timer slack of range(1) microseconds
+template <typename Engine = io_engine>
+void timer_storm(benchmark::State &state, io_engine::backend kind) {
+  Engine engine({.kind = kind,
+                 .timer_slack = std::chrono::microseconds(state.range(1))});
+  auto count = static_cast<std::size_t>(state.range(0));
+
+  auto sleeper = [&](std::chrono::nanoseconds delay) -> eager_task<void> {
+    co_await engine.wait_for(delay);
+  };
+
+  std::vector<eager_task<void>> tasks;
+  tasks.reserve(count);
+  for (auto _ : state) {
+    for (std::size_t i = 0; i < count; ++i)
+      tasks.push_back(sleeper(std::chrono::nanoseconds(i * 7919 % 1'000'000)));
+    engine.pull_all();
+    tasks.clear();
+  }
+
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// timers spread over 1000s expired by the manual clock, which jumps from one
+// deadline to the next (one item is one timer)
+void timer_simulation(benchmark::State &state, io_engine::backend kind) {
+  io_engine engine({.kind = kind, .clock = io_engine::clock_source::manual});
+  auto count = static_cast<std::size_t>(state.range(0));
+
+  auto sleeper = [&](std::chrono::milliseconds delay) -> eager_task<void> {
+    co_await engine.wait_for(delay);
+  };
+
+  std::vector<eager_task<void>> tasks;
+  tasks.reserve(count);
+  for (auto _ : state) {
+    for (std::size_t i = 0; i < count; ++i)
+      tasks.push_back(sleeper(std::chrono::milliseconds(i * 7919 % 1'000'000)));
+    engine.pull_all();
+    tasks.clear();
+  }
+
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// one fd made readable while range(0) others are waited for and stay idle,
+// shows how the cost of a wakeup scales with the number of pollers
+void idle_fds(benchmark::State &state, io_engine::backend kind) {
+  auto count = static_cast<std::size_t>(state.range(0));
+
+  // every poller has an fd of its own
+  rlimit limit;
+  ::getrlimit(RLIMIT_NOFILE, &limit);
+  if (limit.rlim_cur < count + 64) {
+    limit.rlim_cur = std::min<rlim_t>(limit.rlim_max, count + 64);
+    ::setrlimit(RLIMIT_NOFILE, &limit);
+  }
+  if (limit.rlim_cur < count + 64) {
+    state.SkipWithError("RLIMIT_NOFILE is too low");
+    return;
+  }
+
+  io_engine engine(kind);
+
+  std::vector<utils::handle> idle;
+  idle.reserve(count);
+  for (std::size_t i = 0; i < count; ++i)
+    idle.emplace_back(::eventfd(0, EFD_NONBLOCK));
+
+  std::stop_source stop;
+  auto waiter = [&](const utils::handle &fd) -> eager_task<void> {
+    co_await engine.poll(fd, POLLIN, stop.get_token(), std::nothrow);
+  };
+
+  std::vector<eager_task<void>> waiters;
+  waiters.reserve(count);
+  for (auto &fd : idle)
+    waiters.push_back(waiter(fd));
+
+  utils::handle active(::eventfd(0, EFD_NONBLOCK));
+  std::size_t woken = 0;
+  auto reader = [&]() -> eager_task<void> {
+    while (!stop.stop_requested()) {
+      auto ready = co_await engine.poll(active, POLLIN, stop.get_token(),
+                                        std::nothrow);
+      if (!ready)
+        break;
+
+      take(active);
+      ++woken;
+    }
+  };
+  auto task = reader();
+
+  for (auto _ : state) {
+    put(active);
+    for (auto before = woken; woken == before;)
+      engine.pull_wait();
+  }
+
+  stop.request_stop();
+  engine.pull_all();
+
+  state.SetItemsProcessed(state.iterations());
+}
+
+[[maybe_unused]] const bool registered =
+    bench::register_backends("ping_pong", ping_pong<>,
+                             [](auto *b) { b->Arg(1000); }) &&
+    bench::register_backends("ping_pong_under_flood", ping_pong_under_flood,
+                             [](auto *b) {
+                               b->ArgNames({"priority", "flood"})
+                                   ->Args({static_cast<int>(priority::bulk),
+                                           1000})
+                                   ->Args({static_cast<int>(priority::critical),
+                                           1000});
+                             }) &&
+    bench::register_backends("duplex_ping_pong", duplex_ping_pong,
+                             [](auto *b) { b->Arg(1000); }) &&
+    bench::register_backends("stream_ping_pong", stream_ping_pong,
+                             [](auto *b) { b->Arg(1000); }) &&
+    bench::register_backends("timer_storm", timer_storm<>,
+                             [](auto *b) {
+                               b->Args({100'000, 0})
+                                   ->Args({100'000, 250})
+                                   ->Unit(benchmark::kMillisecond);
+                             }) &&
+    bench::register_backends("timer_simulation", timer_simulation,
+                             [](auto *b) {
+                               b->Arg(100'000)->Unit(benchmark::kMillisecond);
+                             }) &&
+    bench::register_backends("idle_fds", idle_fds, [](auto *b) {
+      b->Arg(1'000)->Arg(10'000)->Arg(100'000);
+    }) &&
+    benchmark::RegisterBenchmark(
+        "ping_pong/static_epoll",
+        [](benchmark::State &state) {
+          ping_pong<static_epoll_engine>(state, io_backend::epoll);
+        })
+        ->Arg(1000) &&
+    benchmark::RegisterBenchmark(
+        "timer_storm/static_epoll",
+        [](benchmark::State &state) {
+          timer_storm<static_epoll_engine>(state, io_backend::epoll);
+        })
+        ->Args({100'000, 0})
+        ->Unit(benchmark::kMillisecond);
+
+} // namespace
@@ -0,0 +1,75 @@
+#include "common.hpp"
+#include "file_stream.hpp"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace coro;
+
+namespace {
+
+// a 32 MiB file written once and removed at exit, in the page cache from then
+// on (the numbers are those of the streams, not of the device)
+struct scan_file {
+  scan_file() {
+    utils::handle fd(::mkstemp(path.data()));
+    std::vector<char> data(32 << 20, 'x');
+    for (std::size_t written = 0; written < data.size();) {
+      auto n = ::write(static_cast<int>(fd), data.data() + written,
+                       data.size() - written);
+      if (n <= 0)
+        break;
+      written += static_cast<std::size_t>(n);
+    }
+  }
+  ~scan_file() { ::unlink(path.c_str()); }
+
+  std::string path = "/tmp/coro-asyncio-bench-XXXXXX";
+};
+
+// the file streamed in chunks of range(1) bytes, with file_mode range(0)
+void file_scan(benchmark::State &state, io_engine::backend kind) {
+  static const scan_file file;
+  io_engine engine(kind);
+  file_stream_options opts{.mode = static_cast<file_mode>(state.range(0)),
+                           .chunk_size =
+                               static_cast<std::size_t>(state.range(1))};
+
+  std::size_t bytes = 0;
+  std::size_t sum = 0;
+  for (auto _ : state) {
+    auto scan = [&]() -> eager_task<void> {
+      auto chunks = stream_file(engine, file.path, opts);
+      for (auto it = co_await chunks.begin(); it != chunks.end();
+           co_await ++it) {
+        // a byte of every page, mapped pages are faulted in when touched
+        auto chunk = *it;
+        for (std::size_t i = 0; i < chunk.size(); i += 4096)
+          sum += static_cast<unsigned char>(chunk[i]);
+        bytes += chunk.size();
+      }
+    };
+
+    auto t = scan();
+    engine.pull_all();
+  }
+
+  benchmark::DoNotOptimize(sum);
+  state.SetBytesProcessed(static_cast<std::int64_t>(bytes));
+}
+
+[[maybe_unused]] const bool registered =
+    bench::register_backends("file_scan", file_scan, [](auto *b) {
+      b->ArgNames({"mode", "chunk"})
+          ->Args({static_cast<int>(file_mode::mmap), 1 << 20})
+          ->Args({static_cast<int>(file_mode::direct), 1 << 20})
+          ->Args({static_cast<int>(file_mode::direct), 64 << 10});
+    });
+
+} // namespace
@@ -0,0 +1,92 @@
+#include "common.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+using namespace coro;
+
+namespace {
+
+generator<std::uint64_t> iota(std::uint64_t count) {
+  for (std::uint64_t i = 0; i < count; ++i)
+    co_yield i;
+}
+
+async_generator<std::uint64_t> async_iota(std::uint64_t count) {
+  for (std::uint64_t i = 0; i < count; ++i)
+    co_yield i;
+}
+
+async_batch_generator<std::uint64_t> batch_iota(std::uint64_t count) {
+  for (std::uint64_t i = 0; i < count; ++i)
+    co_yield i;
+}
+
+// the baseline the generators are compared with (one item is one value)
+void hand_written_loop(benchmark::State &state) {
+  auto count = static_cast<std::uint64_t>(state.range(0));
+  for (auto _ : state) {
+    std::uint64_t sum = 0;
+    for (std::uint64_t i = 0; i < count; ++i) {
+      sum += i;
+      benchmark::DoNotOptimize(sum);
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void generator_loop(benchmark::State &state) {
+  auto count = static_cast<std::uint64_t>(state.range(0));
+  for (auto _ : state) {
+    std::uint64_t sum = 0;
+    for (auto value : iota(count)) {
+      sum += value;
+      benchmark::DoNotOptimize(sum);
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void async_generator_loop(benchmark::State &state) {
+  auto count = static_cast<std::uint64_t>(state.range(0));
+
+  auto consume = [&]() -> eager_task<void> {
+    std::uint64_t sum = 0;
+    auto values = async_iota(count);
+    for (auto it = co_await values.begin(); it != values.end(); co_await ++it) {
+      sum += *it;
+      benchmark::DoNotOptimize(sum);
+    }
+  };
+  for (auto _ : state)
+    auto task = consume();
+
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void async_batch_generator_loop(benchmark::State &state) {
+  auto count = static_cast<std::uint64_t>(state.range(0));
+
+  auto consume = [&]() -> eager_task<void> {
+    std::uint64_t sum = 0;
+    auto values = batch_iota(count);
+    for (auto it = co_await values.begin(); it != values.end(); co_await ++it)
+      for (auto value : *it) {
+        sum += value;
+        benchmark::DoNotOptimize(sum);
+      }
+  };
+  for (auto _ : state)
+    auto task = consume();
+
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK(hand_written_loop)->Arg(1024);
+BENCHMARK(generator_loop)->Arg(1024);
+BENCHMARK(async_generator_loop)->Arg(1024);
+BENCHMARK(async_batch_generator_loop)->Arg(1024);
+
+} // namespace
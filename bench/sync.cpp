@@ -0,0 +1,87 @@
+#include "channel.hpp"
+#include "common.hpp"
+#include "sync.hpp"
+
+#include <cstddef>
+#include <vector>
+
+using namespace coro;
+
+namespace {
+
+// range(0) values sent from one coroutine to another through a channel of
+// capacity range(1), they wake each other within the pulls of the engine
+template <channel_kind Kind>
+void channel_pipeline(benchmark::State &state, io_engine::backend kind) {
+  io_engine engine(kind);
+  auto count = static_cast<std::size_t>(state.range(0));
+  auto capacity = static_cast<std::size_t>(state.range(1));
+
+  std::size_t sum = 0;
+  for (auto _ : state) {
+    channel<std::size_t, Kind> values(capacity);
+    auto producer = [&]() -> eager_task<void> {
+      co_await engine.schedule();
+      for (std::size_t i = 0; i < count; ++i)
+        co_await values.send(i);
+      values.close();
+    };
+    auto consumer = [&]() -> eager_task<void> {
+      co_await engine.schedule();
+      while (auto value = co_await values.receive())
+        sum += *value;
+    };
+
+    auto c = consumer();
+    auto p = producer();
+    engine.pull_all();
+  }
+
+  benchmark::DoNotOptimize(sum);
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// range(0) coroutines taking turns on an async_mutex 16 times each
+void mutex_contended(benchmark::State &state, io_engine::backend kind) {
+  io_engine engine(kind);
+  auto count = static_cast<std::size_t>(state.range(0));
+
+  async_mutex mutex;
+  std::size_t shared = 0;
+  auto worker = [&]() -> eager_task<void> {
+    co_await engine.schedule();
+    for (int i = 0; i < 16; ++i) {
+      auto lock = co_await mutex.scoped_lock();
+      ++shared;
+      co_await engine.schedule();
+    }
+  };
+
+  std::vector<eager_task<void>> tasks;
+  tasks.reserve(count);
+  for (auto _ : state) {
+    for (std::size_t i = 0; i < count; ++i)
+      tasks.push_back(worker());
+    engine.pull_all();
+    tasks.clear();
+  }
+
+  benchmark::DoNotOptimize(shared);
+  state.SetItemsProcessed(state.iterations() * state.range(0) * 16);
+}
+
+[[maybe_unused]] const bool registered =
+    bench::register_backends("channel_pipeline/spsc",
+                             channel_pipeline<channel_kind::spsc>,
+                             [](auto *b) {
+                               b->Args({4096, 1})->Args({4096, 64});
+                             }) &&
+    bench::register_backends("channel_pipeline/mpmc",
+                             channel_pipeline<channel_kind::mpmc>,
+                             [](auto *b) {
+                               b->Args({4096, 1})->Args({4096, 64});
+                             }) &&
+    bench::register_backends("mutex_contended", mutex_contended,
+                             [](auto *b) { b->Arg(64); });
+
+} // namespace
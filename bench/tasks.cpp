@@ -0,0 +1,119 @@
+#include "common.hpp"
+#include "task_group.hpp"
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+using namespace coro;
+
+namespace {
+
+lazy_task<std::size_t> chain(std::size_t depth) {
+  if (depth == 0)
+    co_return 0;
+
+  co_return co_await chain(depth - 1) + 1;
+}
+
+// lazy_tasks awaiting each other range(0) deep (one item is one task)
+void lazy_chain(benchmark::State &state) {
+  auto depth = static_cast<std::size_t>(state.range(0));
+  std::size_t result = 0;
+
+  auto root = [&]() -> eager_task<void> { result = co_await chain(depth); };
+  for (auto _ : state) {
+    auto task = root();
+    benchmark::DoNotOptimize(result);
+  }
+
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+eager_task<int> spawned(int value) { co_return value; }
+
+// eager_tasks created, run to completion and destroyed
+void eager_spawn(benchmark::State &state) {
+  int value = 0;
+  for (auto _ : state) {
+    auto task = spawned(value++);
+    benchmark::DoNotOptimize(task);
+  }
+
+  state.SetItemsProcessed(state.iterations());
+}
+
+// eager_tasks handed over to the engine and resumed by its pull, range(0) per
+// pull
+void scheduled_spawn(benchmark::State &state, io_engine::backend kind) {
+  io_engine engine(kind);
+  auto count = static_cast<std::size_t>(state.range(0));
+
+  auto task = [&]() -> eager_task<void> { co_await engine.schedule(); };
+  std::vector<eager_task<void>> tasks;
+  tasks.reserve(count);
+  for (auto _ : state) {
+    for (std::size_t i = 0; i < count; ++i)
+      tasks.push_back(task());
+    engine.pull_all();
+    tasks.clear();
+  }
+
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+eager_task<void> child(std::size_t &sum, std::size_t value) {
+  sum += value;
+  co_return;
+}
+
+// range(0) children kept in a vector and awaited one at a time
+void eager_fanout(benchmark::State &state) {
+  auto count = static_cast<std::size_t>(state.range(0));
+  std::size_t sum = 0;
+
+  auto root = [&]() -> eager_task<void> {
+    std::vector<eager_task<void>> children;
+    children.reserve(count);
+    for (std::size_t i = 0; i < count; ++i)
+      children.push_back(child(sum, i));
+    for (auto &c : children)
+      co_await c;
+  };
+  for (auto _ : state) {
+    auto task = root();
+    benchmark::DoNotOptimize(sum);
+  }
+
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// the same children spawned in a task_group (frames from its arena) and
+// joined at once
+void task_group_fanout(benchmark::State &state) {
+  auto count = static_cast<std::size_t>(state.range(0));
+  std::size_t sum = 0;
+
+  task_group group(count * 256);
+  auto root = [&]() -> eager_task<void> {
+    for (std::size_t i = 0; i < count; ++i)
+      group.spawn(child, std::ref(sum), i);
+    co_await group.join();
+  };
+  for (auto _ : state) {
+    auto task = root();
+    benchmark::DoNotOptimize(sum);
+  }
+
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK(lazy_chain)->Arg(1)->Arg(16)->Arg(256)->Arg(4096);
+BENCHMARK(eager_spawn);
+BENCHMARK(eager_fanout)->Arg(16)->Arg(256);
+BENCHMARK(task_group_fanout)->Arg(16)->Arg(256);
+
+[[maybe_unused]] const bool registered = bench::register_backends(
+    "scheduled_spawn", scheduled_spawn, [](auto *b) { b->Arg(1024); });
+
+} // namespace
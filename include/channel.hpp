@@ -0,0 +1,416 @@
+#pragma once
+
+#include "sync.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+namespace coro {
+
+enum class channel_kind {
+  // one sending and one receiving coroutine at a time
+  spsc,
+  // any number of both, on any threads
+  mpmc,
+};
+
+namespace detail {
+
+// the indexes of both sides are kept apart so they do not share a cache line
+inline constexpr std::size_t cache_line = 64;
+
+template <typename T> struct ring_slot {
+  T *get() { return std::launder(reinterpret_cast<T *>(storage)); }
+
+  alignas(T) std::byte storage[sizeof(T)];
+};
+
+// bounded single producer single consumer ring, each side only writes its
+// own index and caches the other one
+template <typename T> class spsc_ring {
+public:
+  explicit spsc_ring(std::size_t capacity)
+      : mask(std::bit_ceil(std::max<std::size_t>(capacity, 1)) - 1),
+        slots(std::make_unique<ring_slot<T>[]>(mask + 1)) {}
+  spsc_ring(const spsc_ring &) = delete;
+  spsc_ring &operator=(const spsc_ring &) = delete;
+
+  ~spsc_ring() {
+    while (try_pop())
+      ;
+  }
+
+  std::size_t capacity() const { return mask + 1; }
+
+  // value is only consumed on success
+  template <typename U> bool try_push(U &&value) {
+    std::size_t t = tail.load(std::memory_order_relaxed);
+    if (t - head_cache > mask) {
+      head_cache = head.load(std::memory_order_acquire);
+      if (t - head_cache > mask)
+        return false;
+    }
+
+    std::construct_at(slots[t & mask].get(), std::forward<U>(value));
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  std::optional<T> try_pop() {
+    std::size_t h = head.load(std::memory_order_relaxed);
+    if (h == tail_cache) {
+      tail_cache = tail.load(std::memory_order_acquire);
+      if (h == tail_cache)
+        return std::nullopt;
+    }
+
+    T *slot = slots[h & mask].get();
+    std::optional<T> value(std::move(*slot));
+    std::destroy_at(slot);
+    head.store(h + 1, std::memory_order_release);
+    return value;
+  }
+
+private:
+  const std::size_t mask;
+  std::unique_ptr<ring_slot<T>[]> slots;
+
+  // consumer side
+  alignas(cache_line) std::atomic<std::size_t> head = 0;
+  std::size_t tail_cache = 0;
+
+  // producer side
+  alignas(cache_line) std::atomic<std::size_t> tail = 0;
+  std::size_t head_cache = 0;
+};
+
+// bounded multi producer multi consumer ring (Vyukov's), every cell has a
+// sequence number telling whose turn it is, so both sides only CAS an index
+// (it needs two cells at least, with one of them a consumed cell would look
+// like a produced one)
+template <typename T> class mpmc_ring {
+public:
+  explicit mpmc_ring(std::size_t capacity)
+      : mask(std::bit_ceil(std::max<std::size_t>(capacity, 2)) - 1),
+        cells(std::make_unique<cell[]>(mask + 1)) {
+    for (std::size_t i = 0; i <= mask; ++i)
+      cells[i].sequence.store(i, std::memory_order_relaxed);
+  }
+  mpmc_ring(const mpmc_ring &) = delete;
+  mpmc_ring &operator=(const mpmc_ring &) = delete;
+
+  ~mpmc_ring() {
+    while (try_pop())
+      ;
+  }
+
+  std::size_t capacity() const { return mask + 1; }
+
+  // value is only consumed on success
+  template <typename U> bool try_push(U &&value) {
+    std::size_t pos = tail.load(std::memory_order_relaxed);
+    while (true) {
+      cell &c = cells[pos & mask];
+      std::size_t sequence = c.sequence.load(std::memory_order_acquire);
+      auto diff = static_cast<std::intptr_t>(sequence - pos);
+
+      if (diff == 0) {
+        if (tail.compare_exchange_weak(pos, pos + 1,
+                                       std::memory_order_relaxed)) {
+          std::construct_at(c.slot.get(), std::forward<U>(value));
+          c.sequence.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        // full (the cell was not consumed yet)
+        return false;
+      } else {
+        pos = tail.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  std::optional<T> try_pop() {
+    std::size_t pos = head.load(std::memory_order_relaxed);
+    while (true) {
+      cell &c = cells[pos & mask];
+      std::size_t sequence = c.sequence.load(std::memory_order_acquire);
+      auto diff = static_cast<std::intptr_t>(sequence - (pos + 1));
+
+      if (diff == 0) {
+        if (head.compare_exchange_weak(pos, pos + 1,
+                                       std::memory_order_relaxed)) {
+          T *slot = c.slot.get();
+          std::optional<T> value(std::move(*slot));
+          std::destroy_at(slot);
+          c.sequence.store(pos + mask + 1, std::memory_order_release);
+          return value;
+        }
+      } else if (diff < 0) {
+        // empty (the cell was not produced yet)
+        return std::nullopt;
+      } else {
+        pos = head.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+private:
+  struct cell {
+    std::atomic<std::size_t> sequence;
+    ring_slot<T> slot;
+  };
+
+  const std::size_t mask;
+  std::unique_ptr<cell[]> cells;
+
+  alignas(cache_line) std::atomic<std::size_t> head = 0;
+  alignas(cache_line) std::atomic<std::size_t> tail = 0;
+};
+
+} // namespace detail
+
+/*
+bounded channel between coroutines (of the same engine or of any threads),
+values go through a lock-free ring buffer and never touch the kernel
+
+send suspends while the ring is full and receive while it is empty, the one
+making room (or sending a value) hands it over to the waiter directly and
+wakes it: waiters of the same engine are resumed by the running pull, those of
+other threads are posted to their engine (see detail::sync_access)
+
+the lock is only taken by coroutines that have to wait and by those waking
+them, once closed send fails and receive drains what is left (values sent
+concurrently with close may be dropped)
+*/
+template <typename T, channel_kind Kind = channel_kind::mpmc> class channel {
+  static_assert(std::is_nothrow_move_constructible_v<T>,
+                "channel values are moved in and out of the ring");
+
+public:
+  // capacity is rounded up to a power of two (2 at least for mpmc)
+  explicit channel(std::size_t capacity) : ring(capacity) {}
+  channel(const channel &) = delete;
+  channel &operator=(const channel &) = delete;
+
+  // nobody may be waiting anymore
+  ~channel() { assert(senders.empty() && receivers.empty()); }
+
+  std::size_t capacity() const { return ring.capacity(); }
+
+  // false if full or closed, value is only consumed on success
+  template <typename U>
+    requires std::is_constructible_v<T, U &&>
+  bool try_send(U &&value) {
+    if (closed() || !ring.try_push(std::forward<U>(value)))
+      return false;
+
+    wake_all(hand_to_receivers());
+    return true;
+  }
+
+  // std::nullopt if empty
+  std::optional<T> try_receive() {
+    auto value = ring.try_pop();
+    if (value)
+      wake_all(refill_from_senders());
+    return value;
+  }
+
+  // awaits room for value, returns false (and drops value) when closed
+  auto send(T value) { return send_awaiter{{}, *this, std::move(value)}; }
+
+  // awaits a value, std::nullopt once closed and empty
+  auto receive() { return receive_awaiter{{}, *this, std::nullopt}; }
+
+  // fail the senders waiting and the following ones, wake the receivers
+  // waiting (the values still in the ring can be received)
+  void close() {
+    detail::waiter_list<waiter> woken;
+    {
+      std::lock_guard lock(mutex);
+      is_closed.store(true, std::memory_order_release);
+      while (auto *s = senders.pop_front())
+        woken.push_back(s);
+      while (auto *r = receivers.pop_front())
+        woken.push_back(r);
+      senders_waiting.store(0, std::memory_order_relaxed);
+      receivers_waiting.store(0, std::memory_order_relaxed);
+    }
+    wake_all(woken);
+  }
+
+  bool closed() const { return is_closed.load(std::memory_order_acquire); }
+
+private:
+  using waiter = detail::sync_access::waiter;
+  using ring_type = std::conditional_t<Kind == channel_kind::spsc,
+                                       detail::spsc_ring<T>,
+                                       detail::mpmc_ring<T>>;
+
+  struct send_awaiter : waiter {
+    channel &self;
+    T value;
+    // decided by await_ready or the one waking it
+    bool sent = false;
+
+    bool await_ready() {
+      if (self.closed())
+        return true;
+      if (!self.ring.try_push(std::move(value)))
+        return false;
+
+      sent = true;
+      self.wake_all(self.hand_to_receivers());
+      return true;
+    }
+    bool await_suspend(std::coroutine_handle<> handle) {
+      suspend(handle);
+      {
+        std::unique_lock lock(self.mutex);
+        self.senders_waiting.fetch_add(1, std::memory_order_relaxed);
+        // pairs with the fence of the receivers: either they see us waiting
+        // or we see the room they left
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (self.is_closed.load(std::memory_order_relaxed)) {
+          self.senders_waiting.fetch_sub(1, std::memory_order_relaxed);
+          return false;
+        }
+        if (!self.ring.try_push(std::move(value))) {
+          self.senders.push_back(this);
+          return true;
+        }
+        self.senders_waiting.fetch_sub(1, std::memory_order_relaxed);
+      }
+
+      sent = true;
+      self.wake_all(self.hand_to_receivers());
+      return false;
+    }
+    bool await_resume() const { return sent; }
+  };
+
+  struct receive_awaiter : waiter {
+    channel &self;
+    std::optional<T> value;
+
+    bool await_ready() {
+      value = self.ring.try_pop();
+      if (value) {
+        self.wake_all(self.refill_from_senders());
+        return true;
+      }
+      return self.closed();
+    }
+    bool await_suspend(std::coroutine_handle<> handle) {
+      suspend(handle);
+      {
+        std::unique_lock lock(self.mutex);
+        self.receivers_waiting.fetch_add(1, std::memory_order_relaxed);
+        // pairs with the fence of the senders
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        value = self.ring.try_pop();
+        if (!value && !self.is_closed.load(std::memory_order_relaxed)) {
+          self.receivers.push_back(this);
+          return true;
+        }
+        self.receivers_waiting.fetch_sub(1, std::memory_order_relaxed);
+      }
+
+      if (value)
+        self.wake_all(self.refill_from_senders());
+      return false;
+    }
+    // woken by close, the ring may still hold values sent before it
+    std::optional<T> await_resume() {
+      if (!value)
+        value = self.ring.try_pop();
+      return std::move(value);
+    }
+  };
+
+  // after a push: are receivers waiting for it
+  bool receivers_waiting_seen() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return receivers_waiting.load(std::memory_order_relaxed) > 0;
+  }
+
+  // the waiting receivers that got a value from the ring (to be woken after
+  // the lock is released)
+  detail::waiter_list<waiter> hand_to_receivers() {
+    detail::waiter_list<waiter> woken;
+    if (!receivers_waiting_seen())
+      return woken;
+
+    std::lock_guard lock(mutex);
+    while (!receivers.empty()) {
+      auto value = ring.try_pop();
+      if (!value)
+        break;
+
+      auto *r = static_cast<receive_awaiter *>(receivers.pop_front());
+      r->value = std::move(value);
+      receivers_waiting.fetch_sub(1, std::memory_order_relaxed);
+      woken.push_back(r);
+    }
+    return woken;
+  }
+
+  // after a pop: the waiting senders whose value could be pushed
+  detail::waiter_list<waiter> refill_from_senders() {
+    detail::waiter_list<waiter> woken;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (senders_waiting.load(std::memory_order_relaxed) == 0)
+      return woken;
+
+    {
+      std::lock_guard lock(mutex);
+      while (!senders.empty()) {
+        auto *s = static_cast<send_awaiter *>(senders.front());
+        if (!ring.try_push(std::move(s->value)))
+          break;
+
+        senders.pop_front();
+        s->sent = true;
+        senders_waiting.fetch_sub(1, std::memory_order_relaxed);
+        woken.push_back(s);
+      }
+    }
+
+    // the values pushed for them may be awaited (mpmc only)
+    auto receivers = hand_to_receivers();
+    while (auto *r = receivers.pop_front())
+      woken.push_back(r);
+    return woken;
+  }
+
+  static void wake_all(detail::waiter_list<waiter> woken) {
+    while (auto *w = woken.pop_front())
+      detail::sync_access::wake(*w);
+  }
+
+  ring_type ring;
+  std::atomic<bool> is_closed = false;
+
+  std::mutex mutex;
+  detail::waiter_list<waiter> senders;
+  detail::waiter_list<waiter> receivers;
+  // registered waiters, checked without the lock after every push and pop
+  std::atomic<std::size_t> senders_waiting = 0;
+  std::atomic<std::size_t> receivers_waiting = 0;
+};
+
+} // namespace coro
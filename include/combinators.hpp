@@ -0,0 +1,319 @@
+#pragma once
+
+#include "io_engine.hpp"
+
+#include <array>
+#include <coroutine>
+#include <cstddef>
+#include <iterator>
+#include <optional>
+#include <ranges>
+#include <stop_token>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace coro {
+
+namespace detail {
+
+template <typename T> struct is_join_task : std::false_type {};
+template <typename T> struct is_join_task<lazy_task<T>> : std::true_type {};
+template <typename T> struct is_join_task<eager_task<T>> : std::true_type {};
+
+template <typename T>
+concept join_task = is_join_task<std::remove_cvref_t<T>>::value;
+
+template <typename Task>
+using join_value_t = typename std::remove_cvref_t<Task>::value_type;
+
+// void tasks contribute an empty value to tuples and variants
+template <typename Task>
+using join_result_t = std::conditional_t<std::is_void_v<join_value_t<Task>>,
+                                         std::monostate, join_value_t<Task>>;
+
+struct join_access {
+  // the task reports to state instead of resuming a continuation, a lazy task
+  // is started right away (an eager one is already running)
+  template <typename Task>
+  static void start(Task &task, join_state &state, std::size_t index,
+                    const std::stop_token &token) {
+    auto handle = *task.handle;
+    constexpr bool lazy =
+        std::is_same_v<std::remove_cvref_t<Task>, lazy_task<join_value_t<Task>>>;
+
+    // when_any is already decided, there is no point in running the task
+    bool decided = state.stop && state.winner.load(std::memory_order_acquire) !=
+                                     join_state::npos;
+    if (handle.done() || (lazy && decided)) {
+      // the combinator holds a count of its own, this is never the last one
+      state.complete(index);
+      return;
+    }
+
+    auto &promise = handle.promise();
+    promise.join = &state;
+    promise.join_index = index;
+    promise.stop_token = token;
+    if constexpr (lazy)
+      handle.resume();
+  }
+
+  // the task sees token through get_stop_token (and passes it on to the
+  // tasks it awaits)
+  template <typename Task>
+  static void inherit(Task &task, std::stop_token token) {
+    (*task.handle).promise().stop_token = std::move(token);
+  }
+
+  template <typename Task> static join_result_t<Task> result(Task &task) {
+    if constexpr (std::is_void_v<join_value_t<Task>>) {
+      task.operator co_await().await_resume();
+      return {};
+    } else {
+      return task.operator co_await().await_resume();
+    }
+  }
+};
+
+template <typename P>
+std::stop_token inherited_stop_token(std::coroutine_handle<P> handle) {
+  if constexpr (requires { handle.promise().stop_token; })
+    return handle.promise().stop_token;
+  else
+    return {};
+}
+
+// requests stop of when_any's children when the awaiting task is stopped
+struct forward_stop {
+  std::stop_source *source;
+
+  void operator()() const noexcept { source->request_stop(); }
+};
+
+template <typename... Tasks> class when_all_awaitable {
+public:
+  explicit when_all_awaitable(Tasks &&...tasks)
+      : tasks(std::forward<Tasks>(tasks)...) {}
+
+  bool await_ready() const noexcept { return sizeof...(Tasks) == 0; }
+  template <typename P> bool await_suspend(std::coroutine_handle<P> handle) {
+    state.continuation = handle;
+    state.remaining.store(sizeof...(Tasks) + 1, std::memory_order_relaxed);
+
+    auto token = inherited_stop_token(handle);
+    [&]<std::size_t... I>(std::index_sequence<I...>) {
+      (join_access::start(std::get<I>(tasks), state, I, token), ...);
+    }(std::index_sequence_for<Tasks...>{});
+
+    return state.remaining.fetch_sub(1, std::memory_order_acq_rel) != 1;
+  }
+  // rethrows the exception of the first task (in argument order) which failed
+  std::tuple<join_result_t<Tasks>...> await_resume() {
+    return std::apply(
+        [](auto &...task) {
+          return std::tuple<join_result_t<Tasks>...>{
+              join_access::result(task)...};
+        },
+        tasks);
+  }
+
+private:
+  std::tuple<Tasks...> tasks;
+  join_state state;
+};
+
+template <typename Range> class when_all_range_awaitable {
+  using task_type = std::ranges::range_value_t<Range>;
+  using value_type = join_value_t<task_type>;
+
+public:
+  explicit when_all_range_awaitable(Range tasks) : tasks(std::move(tasks)) {}
+
+  bool await_ready() const { return std::ranges::empty(tasks); }
+  template <typename P> bool await_suspend(std::coroutine_handle<P> handle) {
+    state.continuation = handle;
+    state.remaining.store(std::ranges::size(tasks) + 1,
+                          std::memory_order_relaxed);
+
+    auto token = inherited_stop_token(handle);
+    std::size_t index = 0;
+    for (auto &task : tasks)
+      join_access::start(task, state, index++, token);
+
+    return state.remaining.fetch_sub(1, std::memory_order_acq_rel) != 1;
+  }
+  auto await_resume() {
+    if constexpr (std::is_void_v<value_type>) {
+      for (auto &task : tasks)
+        join_access::result(task);
+    } else {
+      std::vector<value_type> values;
+      values.reserve(std::ranges::size(tasks));
+      for (auto &task : tasks)
+        values.push_back(join_access::result(task));
+      return values;
+    }
+  }
+
+private:
+  Range tasks;
+  join_state state;
+};
+
+/*
+the children of when_any get the token of an own stop source, which is
+requested by the first one to complete (or when the awaiting task is stopped),
+the awaiting coroutine is resumed once the others have observed it and
+finished as well
+*/
+template <typename... Tasks> class when_any_awaitable {
+  static_assert(sizeof...(Tasks) > 0, "when_any needs at least one task");
+
+public:
+  using result_type = std::variant<join_result_t<Tasks>...>;
+
+  explicit when_any_awaitable(Tasks &&...tasks)
+      : tasks(std::forward<Tasks>(tasks)...) {}
+
+  bool await_ready() const noexcept { return false; }
+  template <typename P> bool await_suspend(std::coroutine_handle<P> handle) {
+    state.continuation = handle;
+    state.stop = &source;
+    state.remaining.store(sizeof...(Tasks) + 1, std::memory_order_relaxed);
+
+    if (auto token = inherited_stop_token(handle); token.stop_possible())
+      parent.emplace(std::move(token), forward_stop{&source});
+
+    auto token = source.get_token();
+    [&]<std::size_t... I>(std::index_sequence<I...>) {
+      (join_access::start(std::get<I>(tasks), state, I, token), ...);
+    }(std::index_sequence_for<Tasks...>{});
+
+    return state.remaining.fetch_sub(1, std::memory_order_acq_rel) != 1;
+  }
+  // result of the first task to complete, rethrown if it failed
+  result_type await_resume() {
+    parent.reset();
+
+    constexpr auto take =
+        []<std::size_t... I>(std::index_sequence<I...>) {
+          return std::array<result_type (*)(when_any_awaitable &),
+                            sizeof...(I)>{&when_any_awaitable::take<I>...};
+        }(std::index_sequence_for<Tasks...>{});
+    return take[state.winner.load(std::memory_order_acquire)](*this);
+  }
+
+private:
+  template <std::size_t I> static result_type take(when_any_awaitable &self) {
+    return result_type(std::in_place_index<I>,
+                       join_access::result(std::get<I>(self.tasks)));
+  }
+
+  std::tuple<Tasks...> tasks;
+  join_state state;
+  std::stop_source source;
+  std::optional<std::stop_callback<forward_stop>> parent;
+};
+
+template <typename Range> class when_any_range_awaitable {
+  using task_type = std::ranges::range_value_t<Range>;
+  using value_type = join_value_t<task_type>;
+
+public:
+  explicit when_any_range_awaitable(Range tasks) : tasks(std::move(tasks)) {}
+
+  bool await_ready() const {
+    if (std::ranges::empty(tasks))
+      throw std::invalid_argument("when_any needs at least one task");
+    return false;
+  }
+  template <typename P> bool await_suspend(std::coroutine_handle<P> handle) {
+    state.continuation = handle;
+    state.stop = &source;
+    state.remaining.store(std::ranges::size(tasks) + 1,
+                          std::memory_order_relaxed);
+
+    if (auto token = inherited_stop_token(handle); token.stop_possible())
+      parent.emplace(std::move(token), forward_stop{&source});
+
+    auto token = source.get_token();
+    std::size_t index = 0;
+    for (auto &task : tasks)
+      join_access::start(task, state, index++, token);
+
+    return state.remaining.fetch_sub(1, std::memory_order_acq_rel) != 1;
+  }
+  // index of the first task to complete (and its value)
+  auto await_resume() {
+    parent.reset();
+
+    auto index = state.winner.load(std::memory_order_acquire);
+    auto &task = *std::ranges::next(std::ranges::begin(tasks),
+                                    static_cast<std::ptrdiff_t>(index));
+    if constexpr (std::is_void_v<value_type>) {
+      join_access::result(task);
+      return index;
+    } else {
+      return std::pair<std::size_t, value_type>(index,
+                                                join_access::result(task));
+    }
+  }
+
+private:
+  Range tasks;
+  join_state state;
+  std::stop_source source;
+  std::optional<std::stop_callback<forward_stop>> parent;
+};
+
+template <typename R>
+concept join_range = std::ranges::sized_range<R> &&
+                     std::ranges::forward_range<R> &&
+                     join_task<std::ranges::range_value_t<R>>;
+
+} // namespace detail
+
+/*
+await all the tasks at once and get their values as a tuple (std::monostate
+for void tasks), lvalue tasks are referenced and rvalue ones are moved into
+the awaitable
+
+the children report to a counter kept in the awaitable (no allocation), the
+last one to complete resumes the awaiting coroutine by symmetric transfer, an
+eager_task given must not be completing on another thread meanwhile
+*/
+template <detail::join_task... Tasks> auto when_all(Tasks &&...tasks) {
+  return detail::when_all_awaitable<Tasks...>(std::forward<Tasks>(tasks)...);
+}
+
+// range of tasks, their values are returned as a vector (nothing for void)
+template <detail::join_range R> auto when_all(R &&tasks) {
+  using view = std::views::all_t<R>;
+  return detail::when_all_range_awaitable<view>(
+      std::views::all(std::forward<R>(tasks)));
+}
+
+/*
+await the first of the tasks to complete and get its value as a variant
+indexed like the tasks
+
+the others are asked to stop through get_stop_token (which the engine's
+operations taking a std::stop_token then observe), lazy tasks not started yet
+are never run, the awaiting coroutine is resumed when all of them are done
+*/
+template <detail::join_task... Tasks> auto when_any(Tasks &&...tasks) {
+  return detail::when_any_awaitable<Tasks...>(std::forward<Tasks>(tasks)...);
+}
+
+// range of tasks, returns the index of the first one to complete (paired with
+// its value unless the tasks are void)
+template <detail::join_range R> auto when_any(R &&tasks) {
+  using view = std::views::all_t<R>;
+  return detail::when_any_range_awaitable<view>(
+      std::views::all(std::forward<R>(tasks)));
+}
+
+} // namespace coro
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <system_error>
+#include <type_traits>
+
+namespace coro {
+
+// errors reported by io_engine operations (besides system errors)
+enum class io_errc {
+  pollerr = 1,
+  pollhup,
+  pollnval,
+  engine_destroyed,
+};
+
+const std::error_category &io_category() noexcept;
+
+inline std::error_code make_error_code(io_errc e) noexcept {
+  return {static_cast<int>(e), io_category()};
+}
+
+} // namespace coro
+
+template <> struct std::is_error_code_enum<coro::io_errc> : std::true_type {};
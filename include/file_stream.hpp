@@ -0,0 +1,52 @@
+#pragma once
+
+#include "io_engine.hpp"
+#include "utils.hpp"
+
+#include <cstddef>
+#include <span>
+#include <string>
+
+namespace coro {
+
+enum class file_mode {
+  // the file is mapped and read sequentially through the page cache (the
+  // kernel reads ahead), a page that is not there yet is faulted in on the
+  // engine's thread
+  mmap,
+  // O_DIRECT (when the filesystem supports it) reads into aligned buffers of
+  // the stream, in flight while the consumer looks at earlier chunks with
+  // io_uring, done with pread on the engine's thread by readiness backends
+  direct,
+};
+
+struct file_stream_options {
+  file_mode mode = file_mode::mmap;
+  // bytes per chunk (a multiple of 4096 in direct mode, rounded up)
+  std::size_t chunk_size = 1 << 20;
+  // mmap: bytes asked to be read ahead of the consumer (MADV_WILLNEED), the
+  // stream lets the engine run the other coroutines after each of them
+  std::size_t readahead = 16 << 20;
+  // direct: chunks read at the same time (at least 1)
+  std::size_t in_flight = 4;
+};
+
+/*
+contents of a regular file as consecutive chunks, up to the size it had when
+the stream started; a chunk is valid until the consumer advances, failures
+are thrown as std::system_error
+
+fd has to stay open while the stream is used (O_DIRECT is the caller's
+choice then), the path overload opens the file itself; the stream has to be
+consumed and destroyed on the engine's thread, it may be destroyed before
+the end (reads still in flight complete into buffers it left behind)
+*/
+async_generator<std::span<const std::byte>>
+stream_file(io_engine &engine, const utils::handle &fd,
+            file_stream_options opts = {});
+
+async_generator<std::span<const std::byte>>
+stream_file(io_engine &engine, std::string path,
+            file_stream_options opts = {});
+
+} // namespace coro
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace coro::detail {
+
+/*
+per-thread cache of coroutine frames grouped in size classes
+
+a frame freed on another thread than the one that allocated it is cached by
+the freeing thread (all blocks of a class are interchangeable), each class
+keeps at most max_cached blocks so such a pattern does not grow unbounded
+*/
+class frame_pool {
+public:
+  static constexpr std::size_t granularity = 64;
+  // frames up to 4 KiB are cached
+  static constexpr std::size_t classes = 64;
+  static constexpr std::size_t max_cached = 256;
+
+  static void *allocate(std::size_t size) {
+    std::size_t index = size_class(size);
+    if (index >= classes)
+      return ::operator new(size);
+
+    auto &cache = local;
+    if (block *head = cache.free[index]) {
+      cache.free[index] = head->next;
+      --cache.count[index];
+      return head;
+    }
+
+    return ::operator new((index + 1) * granularity);
+  }
+
+  static void deallocate(void *ptr, std::size_t size) noexcept {
+    std::size_t index = size_class(size);
+    auto &cache = local;
+    if (index >= classes || cache.count[index] >= max_cached ||
+        cache.disabled) {
+      ::operator delete(ptr);
+      return;
+    }
+
+    if (!cache.registered)
+      register_cleanup();
+
+    auto *head = static_cast<block *>(ptr);
+    head->next = cache.free[index];
+    cache.free[index] = head;
+    ++cache.count[index];
+  }
+
+private:
+  struct block {
+    block *next;
+  };
+
+  // trivially destructible, so it stays usable while thread_locals are
+  // destroyed (cleanup, registered when the first block is cached, disables
+  // it)
+  struct cache {
+    block *free[classes];
+    std::size_t count[classes];
+    bool registered;
+    bool disabled;
+  };
+
+  struct cleanup {
+    ~cleanup() {
+      auto &cache = local;
+      cache.disabled = true;
+
+      for (std::size_t i = 0; i < classes; ++i) {
+        while (block *head = cache.free[i]) {
+          cache.free[i] = head->next;
+          ::operator delete(head);
+        }
+        cache.count[i] = 0;
+      }
+    }
+  };
+
+  static std::size_t size_class(std::size_t size) {
+    return (size + granularity - 1) / granularity - 1;
+  }
+
+  static void register_cleanup() {
+    thread_local cleanup guard;
+    (void)guard;
+    local.registered = true;
+  }
+
+  static inline constinit thread_local cache local{};
+};
+
+// placed after the frame, tells how to free it
+struct frame_trailer {
+  void (*deallocate)(void *frame, std::size_t size) noexcept;
+};
+
+template <typename Alloc> struct allocator_trailer : frame_trailer {
+  Alloc alloc;
+};
+
+inline std::size_t trailer_offset(std::size_t size) {
+  constexpr std::size_t align = alignof(std::max_align_t);
+  return (size + align - 1) / align * align;
+}
+
+template <typename Alloc>
+void deallocate_frame(void *frame, std::size_t size) noexcept {
+  using traits = std::allocator_traits<Alloc>;
+
+  std::size_t offset = trailer_offset(size);
+  auto *trailer = reinterpret_cast<allocator_trailer<Alloc> *>(
+      static_cast<std::byte *>(frame) + offset);
+
+  Alloc alloc(std::move(trailer->alloc));
+  trailer->~allocator_trailer<Alloc>();
+  traits::deallocate(alloc, static_cast<std::byte *>(frame),
+                     offset + sizeof(allocator_trailer<Alloc>));
+}
+
+// a memory_resource is used through polymorphic_allocator
+template <typename Alloc> struct frame_allocator {
+  using type =
+      typename std::allocator_traits<Alloc>::template rebind_alloc<std::byte>;
+};
+
+template <typename Resource>
+  requires std::is_convertible_v<Resource *, std::pmr::memory_resource *>
+struct frame_allocator<Resource *> {
+  using type = std::pmr::polymorphic_allocator<std::byte>;
+};
+
+template <typename Alloc>
+void *allocate_frame(std::size_t size, const Alloc &alloc) {
+  using byte_alloc = typename frame_allocator<Alloc>::type;
+  using traits = std::allocator_traits<byte_alloc>;
+
+  static_assert(alignof(allocator_trailer<byte_alloc>) <=
+                alignof(std::max_align_t));
+
+  byte_alloc frame_alloc(alloc);
+  std::size_t offset = trailer_offset(size);
+  std::byte *frame = traits::allocate(
+      frame_alloc, offset + sizeof(allocator_trailer<byte_alloc>));
+
+  ::new (frame + offset) allocator_trailer<byte_alloc>{
+      {&deallocate_frame<byte_alloc>}, std::move(frame_alloc)};
+  return frame;
+}
+
+/*
+base of promise types, coroutine frames come from the thread's frame_pool
+unless the coroutine takes `std::allocator_arg_t, const Alloc &` as its first
+parameters (after the object for member functions), Alloc being an allocator
+or a std::pmr::memory_resource pointer
+*/
+struct frame_allocated {
+  // the next frame allocated by this thread without an allocator comes from
+  // this resource (it is used once), task_group places the frames of its
+  // children in its arena this way
+  static inline constinit thread_local std::pmr::memory_resource
+      *next_resource = nullptr;
+
+  static void *operator new(std::size_t size) {
+    if (auto *resource = std::exchange(next_resource, nullptr))
+      return allocate_frame(size, resource);
+
+    std::size_t offset = trailer_offset(size);
+    void *frame = frame_pool::allocate(offset + sizeof(frame_trailer));
+    ::new (static_cast<std::byte *>(frame) + offset) frame_trailer{nullptr};
+    return frame;
+  }
+
+  template <typename Alloc, typename... Args>
+  static void *operator new(std::size_t size, std::allocator_arg_t,
+                            const Alloc &alloc, const Args &...) {
+    return allocate_frame(size, alloc);
+  }
+
+  template <typename This, typename Alloc, typename... Args>
+  static void *operator new(std::size_t size, const This &,
+                            std::allocator_arg_t, const Alloc &alloc,
+                            const Args &...) {
+    return allocate_frame(size, alloc);
+  }
+
+  static void operator delete(void *frame, std::size_t size) noexcept {
+    std::size_t offset = trailer_offset(size);
+    auto *trailer = reinterpret_cast<frame_trailer *>(
+        static_cast<std::byte *>(frame) + offset);
+
+    if (trailer->deallocate)
+      trailer->deallocate(frame, size);
+    else
+      frame_pool::deallocate(frame, offset + sizeof(frame_trailer));
+  }
+};
+
+} // namespace coro::detail
@@ -1,22 +1,132 @@
 #pragma once
 
+#include "error.hpp"
+#include "frame_allocator.hpp"
+#include "metrics.hpp"
+#include "ring_buffer.hpp"
+#include "timer_heap.hpp"
+#include "tracing.hpp"
 #include "utils.hpp"
 
 #include <poll.h>
-
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
 #include <chrono>
 #include <concepts>
 #include <coroutine>
+#include <cstddef>
+#include <cstdint>
 #include <exception>
-#include <functional>
+#include <expected>
+#include <memory>
+#include <new>
+#include <optional>
 #include <span>
 #include <stdexcept>
+#include <stop_token>
+#include <system_error>
+#include <type_traits>
 #include <vector>
 
+struct io_uring_sqe;
+struct io_uring_buf_ring;
+
 namespace coro {
 
+/*
+scheduling class of a coroutine, awaited tasks inherit it (see set_priority):
+the engine keeps a run queue per class and resumes from them in weighted
+turns (options::priority_weights), so that critical coroutines are not
+queued behind a flood of bulk ones while those still get their share
+*/
+enum class priority : std::uint8_t { critical, normal, bulk };
+inline constexpr std::size_t priority_count = 3;
+
 namespace detail {
-template <typename Task, typename T, typename Initial> struct promise {
+class uring;
+struct join_access;
+struct sync_access;
+
+// completion of the tasks of when_all/when_any, the last one resumes the
+// awaiting coroutine (the first one requests stop for when_any)
+struct join_state {
+  static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+  std::atomic<std::size_t> remaining = 0;
+  std::coroutine_handle<> continuation;
+  std::stop_source *stop = nullptr;
+  std::atomic<std::size_t> winner = npos;
+
+  std::coroutine_handle<> complete(std::size_t index) noexcept {
+    std::size_t expected = npos;
+    if (stop && winner.compare_exchange_strong(expected, index,
+                                               std::memory_order_acq_rel))
+      stop->request_stop();
+
+    if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      return continuation;
+    return std::noop_coroutine();
+  }
+};
+
+// class of the coroutine of handle, normal for those that have none
+template <typename P> priority priority_of(std::coroutine_handle<P> handle) {
+  if constexpr (requires { handle.promise().lane; })
+    return handle.promise().lane;
+  else
+    return priority::normal;
+}
+
+// reads (and replaces with set) the class of the running task
+struct priority_awaiter {
+  std::optional<priority> set;
+  priority lane = priority::normal;
+
+  bool await_ready() const noexcept { return false; }
+  template <typename P>
+  bool await_suspend(std::coroutine_handle<P> handle) noexcept {
+    auto &current = handle.promise().lane;
+    lane = current;
+    if (set)
+      current = *set;
+    return false;
+  }
+  priority await_resume() const noexcept { return lane; }
+};
+
+// resumes a generator for the coroutine consuming it, in its class
+template <typename Promise> struct generator_resumption {
+  std::coroutine_handle<Promise> handle;
+
+  template <typename P>
+  auto await_suspend(std::coroutine_handle<P> continuation) {
+    if constexpr (requires { handle.promise().lane; })
+      handle.promise().lane = priority_of(continuation);
+    handle.promise().continuation = continuation;
+    return handle;
+  }
+};
+
+struct stop_token_awaiter {
+  std::stop_token token;
+
+  bool await_ready() const noexcept { return false; }
+  template <typename P>
+  bool await_suspend(std::coroutine_handle<P> handle) noexcept {
+    token = handle.promise().stop_token;
+    return false;
+  }
+  std::stop_token await_resume() { return std::move(token); }
+};
+
+template <typename Task, typename T, typename Initial>
+struct promise : frame_allocated {
   using handle_type = std::coroutine_handle<promise>;
   auto get_return_object() -> Task {
     return Task{handle_type::from_promise(*this)};
@@ -26,9 +136,13 @@ template <typename Task, typename T, typename Initial> struct promise {
   auto final_suspend() noexcept {
     struct final_awaiter {
       bool await_ready() noexcept { return false; }
-      auto await_suspend(handle_type handle) noexcept {
+      std::coroutine_handle<> await_suspend(handle_type handle) noexcept {
+        auto &promise = handle.promise();
+        if (promise.join)
+          return promise.join->complete(promise.join_index);
+
         // if our task is awaited, we want to resume the awaiting coroutine
-        return handle.promise().continuation;
+        return promise.continuation;
       }
       void await_resume() noexcept {}
     };
@@ -36,20 +150,42 @@ template <typename Task, typename T, typename Initial> struct promise {
     return final_awaiter{};
   }
 
+  promise() {}
+  ~promise() {
+    if (has_value)
+      std::destroy_at(std::addressof(value));
+  }
+
   template <std::convertible_to<T> U> void return_value(U &&value) {
-    this->value = std::forward<U>(value);
+    std::construct_at(std::addressof(this->value), std::forward<U>(value));
+    has_value = true;
   }
   void unhandled_exception() { exception = std::current_exception(); }
 
+  // when_all/when_any are told about completion instead of a continuation
+  join_state *join = nullptr;
+  std::size_t join_index = 0;
+  // see get_stop_token, inherited by awaited tasks
+  std::stop_token stop_token;
+  // see set_priority, inherited by awaited tasks
+  priority lane = priority::normal;
+  // link to the awaiting task, see basic_io_engine::suspended
+  [[no_unique_address]] task_trace trace;
+
 private:
   std::coroutine_handle<> continuation = std::noop_coroutine();
-  T value;
+  // constructed by co_return only, T need not be default-constructible
+  union {
+    T value;
+  };
+  bool has_value = false;
   std::exception_ptr exception = nullptr;
 
   friend Task;
 };
 
-template <typename Task, typename Initial> struct promise<Task, void, Initial> {
+template <typename Task, typename Initial>
+struct promise<Task, void, Initial> : frame_allocated {
   using handle_type = std::coroutine_handle<promise>;
   auto get_return_object() -> Task {
     return Task{handle_type::from_promise(*this)};
@@ -59,9 +195,13 @@ template <typename Task, typename Initial> struct promise<Task, void, Initial> {
   auto final_suspend() noexcept {
     struct final_awaiter {
       bool await_ready() noexcept { return false; }
-      auto await_suspend(handle_type handle) noexcept {
+      std::coroutine_handle<> await_suspend(handle_type handle) noexcept {
+        auto &promise = handle.promise();
+        if (promise.join)
+          return promise.join->complete(promise.join_index);
+
         // if our task is awaited, we want to resume the awaiting coroutine
-        return handle.promise().continuation;
+        return promise.continuation;
       }
       void await_resume() noexcept {}
     };
@@ -72,6 +212,12 @@ template <typename Task, typename Initial> struct promise<Task, void, Initial> {
   void return_void() {}
   void unhandled_exception() { exception = std::current_exception(); }
 
+  join_state *join = nullptr;
+  std::size_t join_index = 0;
+  std::stop_token stop_token;
+  priority lane = priority::normal;
+  [[no_unique_address]] task_trace trace;
+
 private:
   std::coroutine_handle<> continuation = std::noop_coroutine();
   std::exception_ptr exception = nullptr;
@@ -109,13 +255,60 @@ template <typename Promise> struct UniqueHandle {
 
   handle_type handle;
 };
+
+/*
+value yielded by a generator, an rvalue T is pointed to (it lives until the
+generator is resumed), other values are constructed in place once and
+destroyed when the consumer resumes the generator
+*/
+template <typename T> struct yielded {
+  using argument = T &&;
+  using reference = T &;
+
+  yielded() {}
+  ~yielded() { reset(); }
+
+  void point(T &&value) { pointer = std::addressof(value); }
+
+  template <typename U> void emplace(U &&value) {
+    pointer = std::construct_at(std::addressof(storage), std::forward<U>(value));
+    owned = true;
+  }
+
+  void reset() {
+    if (owned) {
+      std::destroy_at(std::addressof(storage));
+      owned = false;
+    }
+  }
+
+  reference get() const { return *pointer; }
+
+  T *pointer = nullptr;
+  union {
+    T storage;
+  };
+  bool owned = false;
+};
+
+// generator<T &> and generator<const T &> just point to the yielded object
+template <typename T> struct yielded<T &> {
+  using argument = T &;
+  using reference = T &;
+
+  void point(T &value) { pointer = std::addressof(value); }
+  void reset() {}
+  reference get() const { return *pointer; }
+
+  T *pointer = nullptr;
+};
 } // namespace detail
 
 // fire-and-forget task (as it is not awaited, we cannot return any
 // value/exception) behaves somewhat like detached std::thread (no return
 // value/joining and exception means terminate)
 struct task {
-  struct promise_type {
+  struct promise_type : detail::frame_allocated {
     // as this is a fire-and-forget task we don't return any handle to the
     // coroutine
     auto get_return_object() -> task { return {}; }
@@ -137,81 +330,109 @@ struct task {
 
 template <typename T = void> class lazy_task {
 public:
+  using value_type = T;
   using promise_type = detail::promise<lazy_task<T>, T, std::suspend_always>;
   using handle_type = std::coroutine_handle<promise_type>;
 
   lazy_task(handle_type handle) : handle(handle) {}
 
-  auto operator co_await() {
-    struct awaiter {
-      handle_type handle;
+  auto operator co_await() { return awaiter{*handle}; }
 
-      bool await_ready() const { return handle.done(); }
-      auto await_suspend(std::coroutine_handle<> continuation) {
-        handle.promise().continuation = continuation;
-        return handle;
-      }
-      T await_resume() {
-        if (handle.promise().exception)
-          std::rethrow_exception(handle.promise().exception);
-
-        if constexpr (std::is_same_v<T, void>) {
-          return;
-        } else {
-          return std::move(handle.promise().value);
-        }
-      }
-    };
+private:
+  struct awaiter {
+    handle_type handle;
 
-    return awaiter{*handle};
-  }
+    bool await_ready() const { return handle.done(); }
+    template <typename P>
+    auto await_suspend(std::coroutine_handle<P> continuation) {
+      if constexpr (requires { continuation.promise().stop_token; })
+        handle.promise().stop_token = continuation.promise().stop_token;
+      handle.promise().lane = detail::priority_of(continuation);
+      detail::trace_await(handle, continuation);
+
+      handle.promise().continuation = continuation;
+      return handle;
+    }
+    T await_resume() {
+      if (handle.promise().exception)
+        std::rethrow_exception(handle.promise().exception);
+
+      if constexpr (std::is_same_v<T, void>) {
+        return;
+      } else {
+        return std::move(handle.promise().value);
+      }
+    }
+  };
 
-private:
   detail::UniqueHandle<promise_type> handle;
+
+  friend detail::join_access;
 };
 
 template <typename T = void> class eager_task {
 public:
+  using value_type = T;
   using promise_type = detail::promise<eager_task<T>, T, std::suspend_never>;
   using handle_type = std::coroutine_handle<promise_type>;
 
   eager_task(handle_type handle) : handle(handle) {}
 
-  auto operator co_await() {
-    struct awaiter {
-      handle_type handle;
+  auto operator co_await() { return awaiter{*handle}; }
 
-      bool await_ready() const { return handle.done(); }
-      void await_suspend(std::coroutine_handle<> continuation) {
-        handle.promise().continuation = continuation;
-        // as it is eagerly started the task is already running (no need to
-        // resume it)
-      }
-      T await_resume() {
-        if (handle.promise().exception)
-          std::rethrow_exception(handle.promise().exception);
-
-        if constexpr (std::is_same_v<T, void>) {
-          return;
-        } else {
-          return std::move(handle.promise().value);
-        }
-      }
-    };
+private:
+  struct awaiter {
+    handle_type handle;
 
-    return awaiter{*handle};
-  }
+    bool await_ready() const { return handle.done(); }
+    template <typename P>
+    void await_suspend(std::coroutine_handle<P> continuation) {
+      if constexpr (requires { continuation.promise().stop_token; })
+        handle.promise().stop_token = continuation.promise().stop_token;
+      detail::trace_await(handle, continuation);
+
+      handle.promise().continuation = continuation;
+      // as it is eagerly started the task is already running (no need to
+      // resume it)
+    }
+    T await_resume() {
+      if (handle.promise().exception)
+        std::rethrow_exception(handle.promise().exception);
+
+      if constexpr (std::is_same_v<T, void>) {
+        return;
+      } else {
+        return std::move(handle.promise().value);
+      }
+    }
+  };
 
-private:
   detail::UniqueHandle<promise_type> handle;
+
+  friend detail::join_access;
 };
 
+// stop token of the running lazy_task/eager_task (requested by when_any for
+// the losers), tasks awaited by it get the same token
+inline auto get_stop_token() { return detail::stop_token_awaiter{}; }
+
+// class of the running lazy_task/eager_task: priority::normal unless set, or
+// inherited by a lazy_task (or async_generator) from the coroutine awaiting
+// it (eager tasks already run when they are awaited and keep their own)
+inline auto get_priority() { return detail::priority_awaiter{}; }
+
+// change the class of the running task (for its next suspensions and the
+// tasks it awaits from then on), returns the previous one
+inline auto set_priority(priority lane) {
+  return detail::priority_awaiter{lane};
+}
+
 template <typename T> class generator {
 public:
   struct promise_type;
   using handle_type = std::coroutine_handle<promise_type>;
 
-  struct promise_type {
+  struct promise_type : detail::frame_allocated {
     auto get_return_object() -> generator {
       return generator{handle_type::from_promise(*this)};
     }
@@ -219,21 +440,40 @@ public:
     std::suspend_always initial_suspend() { return {}; }
     std::suspend_always final_suspend() noexcept { return {}; }
 
-    template <std::convertible_to<T> U> auto yield_value(U &&value) {
-      this->value = std::forward<U>(value);
-      return std::suspend_always{};
+    auto yield_value(typename detail::yielded<T>::argument value) {
+      this->value.point(std::forward<T>(value));
+      return yield_awaiter{*this};
+    }
+
+    template <std::convertible_to<T> U>
+      requires(!std::is_reference_v<T>)
+    auto yield_value(U &&value) {
+      this->value.emplace(std::forward<U>(value));
+      return yield_awaiter{*this};
     }
 
     void return_void() {}
     void unhandled_exception() { exception = std::current_exception(); }
 
-    T value;
+    detail::yielded<T> value;
     std::exception_ptr exception = nullptr;
+
+  private:
+    struct yield_awaiter {
+      bool await_ready() const noexcept { return false; }
+      void await_suspend(std::coroutine_handle<>) noexcept {}
+      // the consumer advanced, drop the value it was looking at
+      void await_resume() noexcept { promise.value.reset(); }
+
+      promise_type &promise;
+    };
   };
 
   struct iterator {
     void operator++() { handle.resume(); }
-    const T &operator*() const { return handle.promise().value; }
+    auto operator*() const -> typename detail::yielded<T>::reference {
+      return handle.promise().value.get();
+    }
     bool operator==(std::default_sentinel_t) const {
       return !handle || handle.done();
     }
@@ -260,7 +500,7 @@ public:
   struct promise_type;
   using handle_type = std::coroutine_handle<promise_type>;
 
-  struct promise_type {
+  struct promise_type : detail::frame_allocated {
     auto get_return_object() -> async_generator {
       return async_generator{handle_type::from_promise(*this)};
     }
@@ -279,76 +519,213 @@ public:
       return final_awaiter{};
     }
 
-    template <std::convertible_to<T> U> auto yield_value(U &&value) {
-      this->value = std::forward<U>(value);
+    auto yield_value(typename detail::yielded<T>::argument value) {
+      this->value.point(std::forward<T>(value));
+      return yield_awaiter{};
+    }
+
+    template <std::convertible_to<T> U>
+      requires(!std::is_reference_v<T>)
+    auto yield_value(U &&value) {
+      this->value.emplace(std::forward<U>(value));
+      return yield_awaiter{};
+    }
+
+    void return_void() {}
+    void unhandled_exception() { exception = std::current_exception(); }
+
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+    detail::yielded<T> value;
+    std::exception_ptr exception = nullptr;
+    // that of the consumer, see set_priority
+    priority lane = priority::normal;
+
+  private:
+    struct yield_awaiter {
+      bool await_ready() const noexcept { return false; }
+      auto await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+        this->handle = handle;
+        return handle.promise().continuation;
+      }
+      // the consumer advanced, drop the value it was looking at
+      void await_resume() noexcept { handle.promise().value.reset(); }
+
+      std::coroutine_handle<promise_type> handle;
+    };
+  };
+
+  async_generator(handle_type handle) : handle(handle) {}
+
+  struct iterator {
+    auto operator++() {
+      struct awaiter : detail::generator_resumption<promise_type> {
+        bool await_ready() const { return false; }
+        void await_resume() {
+          if (this->handle.promise().exception)
+            std::rethrow_exception(this->handle.promise().exception);
+        }
+      };
 
-      struct awaiter {
+      return awaiter{{handle}};
+    }
+    auto operator*() const -> typename detail::yielded<T>::reference {
+      return handle.promise().value.get();
+    }
+
+    bool operator==(std::default_sentinel_t) const {
+      return !handle || handle.done();
+    }
+
+    handle_type handle;
+  };
+
+  auto begin() {
+    struct awaiter : detail::generator_resumption<promise_type> {
+      bool await_ready() const { return this->handle.done(); }
+      auto await_resume() {
+        if (this->handle.promise().exception)
+          std::rethrow_exception(this->handle.promise().exception);
+
+        return iterator{this->handle};
+      }
+    };
+
+    return awaiter{{*handle}};
+  }
+
+  std::default_sentinel_t end() { return {}; }
+
+private:
+  detail::UniqueHandle<promise_type> handle;
+};
+
+// co_yield flush_batch hands the values buffered so far to the consumer of an
+// async_batch_generator (e.g. before awaiting something slow)
+inline constexpr struct flush_batch_t {
+} flush_batch{};
+
+/*
+async generator that hands values to its consumer in batches, the producer
+yields into a buffer of Capacity values and only suspends when it is full,
+flushed or the generator finishes, the consumer gets a span of the buffered
+values per resumption (valid until it advances the iterator)
+*/
+template <typename T, std::size_t Capacity = 64> class async_batch_generator {
+  static_assert(Capacity > 0);
+
+public:
+  struct promise_type;
+  using handle_type = std::coroutine_handle<promise_type>;
+
+  struct promise_type : detail::frame_allocated {
+    promise_type() {}
+    ~promise_type() { clear(); }
+
+    auto get_return_object() -> async_batch_generator {
+      return async_batch_generator{handle_type::from_promise(*this)};
+    }
+
+    std::suspend_always initial_suspend() { return {}; }
+    auto final_suspend() noexcept {
+      struct final_awaiter {
         bool await_ready() const noexcept { return false; }
         auto
         await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
           return handle.promise().continuation;
         }
-        void await_resume() noexcept { return; }
+        void await_resume() noexcept {}
       };
 
-      return awaiter{};
+      return final_awaiter{};
+    }
+
+    template <std::convertible_to<T> U> auto yield_value(U &&value) {
+      std::construct_at(items + size, std::forward<U>(value));
+      ++size;
+      return yield_awaiter{*this, size == Capacity};
     }
 
+    auto yield_value(flush_batch_t) { return yield_awaiter{*this, size > 0}; }
+
     void return_void() {}
     void unhandled_exception() { exception = std::current_exception(); }
 
+    std::span<const T> batch() const { return {items, size}; }
+
+    void clear() {
+      std::destroy_n(items, size);
+      size = 0;
+    }
+
+    // values buffered before an exception are delivered first
+    void rethrow_if_drained() const {
+      if (exception && size == 0)
+        std::rethrow_exception(exception);
+    }
+
     std::coroutine_handle<> continuation = std::noop_coroutine();
-    T value;
+    // that of the consumer, see set_priority
+    priority lane = priority::normal;
+    std::size_t size = 0;
+    union {
+      T items[Capacity];
+    };
     std::exception_ptr exception = nullptr;
+
+  private:
+    struct yield_awaiter {
+      bool await_ready() const noexcept { return !suspend; }
+      auto await_suspend(std::coroutine_handle<promise_type>) noexcept {
+        return promise.continuation;
+      }
+      // the consumer advanced past the batch
+      void await_resume() noexcept {
+        if (suspend)
+          promise.clear();
+      }
+
+      promise_type &promise;
+      bool suspend;
+    };
   };
 
-  async_generator(handle_type handle) : handle(handle) {}
+  async_batch_generator(handle_type handle) : handle(handle) {}
 
   struct iterator {
     auto operator++() {
-      struct awaiter {
-        handle_type handle;
+      struct awaiter : detail::generator_resumption<promise_type> {
+        // the last batch was delivered on completion
+        bool finished = this->handle.done();
 
-        bool await_ready() const { return false; }
-        auto await_suspend(std::coroutine_handle<> continuation) {
-          handle.promise().continuation = continuation;
-          return handle;
-        }
+        bool await_ready() const { return finished; }
         void await_resume() {
-          if (handle.promise().exception)
-            std::rethrow_exception(handle.promise().exception);
+          if (finished)
+            this->handle.promise().clear();
+          this->handle.promise().rethrow_if_drained();
         }
       };
 
-      return awaiter{handle};
+      return awaiter{{handle}};
     }
-    const T &operator*() const { return handle.promise().value; }
+    std::span<const T> operator*() const { return handle.promise().batch(); }
 
     bool operator==(std::default_sentinel_t) const {
-      return !handle || handle.done();
+      return !handle || (handle.done() && handle.promise().size == 0);
     }
 
     handle_type handle;
   };
 
   auto begin() {
-    struct awaiter {
-      bool await_ready() const { return handle.done(); }
-      auto await_suspend(std::coroutine_handle<> continuation) {
-        handle.promise().continuation = continuation;
-        return handle;
-      }
+    struct awaiter : detail::generator_resumption<promise_type> {
+      bool await_ready() const { return this->handle.done(); }
       auto await_resume() {
-        if (handle.promise().exception)
-          std::rethrow_exception(handle.promise().exception);
-
-        return iterator{handle};
+        this->handle.promise().rethrow_if_drained();
+        return iterator{this->handle};
       }
-
-      handle_type handle;
     };
 
-    return awaiter{*handle};
+    return awaiter{{*handle}};
   }
 
   std::default_sentinel_t end() { return {}; }
@@ -357,107 +734,579 @@ private:
   detail::UniqueHandle<promise_type> handle;
 };
 
+// kernel mechanism used by an engine to wait for readiness
+enum class io_backend {
+  // one pollfd per waited fd (the waiters' events merged), scanned by every
+  // pull (O(fds))
+  poll,
+  // fds stay registered in an epoll instance across awaits (O(ready))
+  epoll,
+  // completion based, submissions are batched into one io_uring_enter per
+  // pull
+  io_uring,
+};
+
+// backend policies of basic_io_engine: the one of options::kind, or Kind
+// whatever options::kind says (the branches of the others fold away)
+struct dynamic_backend {};
+template <io_backend Kind> struct static_backend {
+  static constexpr io_backend kind = Kind;
+};
+
 /*
 class that supports awaiting on file descriptors (poll) with timeout
+
+its configuration is fixed at compile time: Backend (see above), TimerQueue
+of the deadlines (interface of detail::timer_heap) and Stats recording the
+metrics (detail::recorded_metrics, or detail::no_metrics whose calls compile
+to nothing); io_engine is the default one, built with the library, the others
+need io_engine_impl.hpp in the translation unit instantiating them
 */
-class io_engine {
+template <typename Backend = dynamic_backend,
+          template <typename> class TimerQueue = detail::timer_heap,
+          typename Stats = detail::engine_metrics>
+class basic_io_engine {
 public:
-  io_engine() = default;
-  io_engine(const io_engine &) = delete;
-  io_engine &operator=(const io_engine &) = delete;
-  io_engine(io_engine &&) = delete;
-  io_engine &operator=(io_engine &&) = delete;
+  using backend = io_backend;
+
+  // time source of the deadlines
+  enum class clock_source {
+    // std::chrono::steady_clock
+    steady,
+    // CLOCK_MONOTONIC_COARSE: cheaper to read, but only as precise as the
+    // kernel tick (a few ms) which timers may be early or late by
+    coarse,
+    // moved only by advance, or by a blocking pull with nothing else to do
+    // jumping to the nearest deadline: timers expire in order as fast as
+    // they are handled (deterministic simulations)
+    manual,
+  };
+
+  struct options {
+    backend kind = backend::epoll;
+    // max number of coroutines resumed by one pull (including those woken
+    // by the resumed ones), the rest stays queued so that new events and
+    // timers are not starved (0 means all those queued when it started)
+    std::size_t resume_budget = 256;
+    // io done right away (without waiting for readiness) by the readiness
+    // backends per resumed coroutine, once spent its io waits for the next
+    // pull so a busy fd cannot starve the rest (0 always waits for readiness)
+    std::size_t inline_budget = 64;
+    // buffers of the pool used by async_read_pooled/async_recv_pooled (at
+    // most 32768, 0 means no pool)
+    std::size_t buffer_count = 0;
+    std::size_t buffer_size = 4096;
+    // blocking pulls first spin with non-blocking checks for at most this
+    // long (0 never spins): the window is twice the average gap observed
+    // between arrivals, and none when it is far longer than busy_poll
+    std::chrono::nanoseconds busy_poll{0};
+    // io_uring only: a kernel thread polls the submission queue so that
+    // submitting needs no syscall, it sleeps after max(busy_poll, 1ms)
+    // without submissions (ignored if the kernel does not permit it)
+    bool sqpoll = false;
+    // deadlines are rounded up to a multiple of it (of the steady clock), so
+    // that close ones expire in the same pull instead of waking the engine
+    // one by one, timers may fire up to this late (0 keeps them exact)
+    std::chrono::nanoseconds timer_slack{0};
+    clock_source clock = clock_source::steady;
+    // coroutines resumed from the critical, normal and bulk run queues per
+    // turn while they have some (0 counts as 1: no class is starved)
+    std::array<std::size_t, priority_count> priority_weights = {8, 4, 1};
+  };
+
+  /*
+  tag of the wait_for/poll_for variants whose deadline does not need to be
+  exact: it is rounded up to a multiple of slack (brought down to a multiple
+  of the engine's timer_slack, at least one of it), by default the largest
+  power of two nanoseconds not above 1/16 of the duration, so timeouts of
+  similar length share buckets
+  */
+  struct coarse {
+    std::chrono::nanoseconds slack{0};
+  };
+
+  /*
+  buffer of the engine's pool holding data of a pooled read, it is returned
+  to the pool when destroyed (which has to happen on the engine's thread
+  before the engine is destroyed), empty at end of file
+  */
+  class buffer_lease {
+  public:
+    buffer_lease() = default;
+    buffer_lease(buffer_lease &&other) noexcept
+        : engine(std::exchange(other.engine, nullptr)), id(other.id),
+          length(std::exchange(other.length, 0)) {}
+    buffer_lease &operator=(buffer_lease other) noexcept {
+      std::swap(engine, other.engine);
+      std::swap(id, other.id);
+      std::swap(length, other.length);
+      return *this;
+    }
+
+    ~buffer_lease() { reset(); }
+
+    void reset() {
+      if (engine)
+        std::exchange(engine, nullptr)->release_buffer(id);
+      length = 0;
+    }
+
+    // the data read (may be modified in place, io from it uses the
+    // registered buffers with io_uring)
+    std::span<std::byte> data() const {
+      if (!engine)
+        return {};
+      return {engine->buffers.base + id * engine->buffers.size, length};
+    }
+    std::size_t size() const { return length; }
+    bool empty() const { return length == 0; }
+
+  private:
+    buffer_lease(basic_io_engine &engine, std::uint16_t id, std::size_t length)
+        : engine(&engine), id(id), length(length) {}
+
+    basic_io_engine *engine = nullptr;
+    std::uint16_t id = 0;
+    std::size_t length = 0;
+
+    friend basic_io_engine;
+  };
+
+  basic_io_engine() : basic_io_engine(options{}) {}
+  explicit basic_io_engine(backend kind) : basic_io_engine(options{kind}) {}
+  explicit basic_io_engine(options opts);
+  basic_io_engine(const basic_io_engine &) = delete;
+  basic_io_engine &operator=(const basic_io_engine &) = delete;
+  basic_io_engine(basic_io_engine &&) = delete;
+  basic_io_engine &operator=(basic_io_engine &&) = delete;
 
-  ~io_engine();
+  ~basic_io_engine();
 
-  // pull until no more ready events
+  // pull ready events without waiting (resumes at most resume_budget
+  // coroutines, the rest is left for the next pull)
   void pull();
 
   // pull all events (wait for the list to be empty)
   void pull_all();
 
-  auto wait_until(std::chrono::time_point<std::chrono::steady_clock> timeout) {
+  // wait for the next event (or deadline) and pull it
+  void pull_wait();
+
+  // the only thread-safe members: they hand coroutines over to the thread
+  // pulling this engine (posted ones are resumed in order by its next pull)
+
+  void post(std::coroutine_handle<> handle);
+
+  // continue the awaiting coroutine on the engine's thread (unlike post
+  // this does not allocate)
+  auto schedule() { return schedule_awaiter{*this, {}}; }
+
+  // interrupt a blocking pull
+  void wake();
+
+  // the backend in use (a constant with static_backend)
+  backend backend_kind() const {
+    if constexpr (requires { Backend::kind; })
+      return Backend::kind;
+    else
+      return kind;
+  }
+
+  // engine pulled by the calling thread (or the one of the io_engine_pool
+  // worker running it), nullptr elsewhere
+  static basic_io_engine *current();
+
+  // time of the engine's clock that deadlines are relative to: read once per
+  // pull (when it is done waiting) and shared by the coroutines it resumes,
+  // read afresh outside of pulls
+  std::chrono::steady_clock::time_point now() const {
+    return pulling || clock == clock_source::manual ? current_time
+                                                    : read_clock();
+  }
+
+  // move the manual clock forward, the timers it passed expire on the next
+  // pull (std::logic_error with the other clocks)
+  void advance(std::chrono::nanoseconds duration);
+
+  // resume the awaiting coroutine once the others resumed by this pull ran
+  // (before the engine waits again), to act on what they left behind
+  auto defer() {
     struct awaiter {
-      io_engine &engine;
-      operation op;
+      basic_io_engine &engine;
 
-      bool await_ready() const {
-        return std::chrono::steady_clock::now() >= op.timeout;
-      }
+      bool await_ready() const { return false; }
       void await_suspend(std::coroutine_handle<> handle) {
-        op.handle = handle;
-        engine.add_operation(&op);
-      }
-      void await_resume() {
-        if (op.exception)
-          std::rethrow_exception(op.exception);
+        engine.end_queue.push_back(handle);
       }
+      void await_resume() {}
     };
 
-    return awaiter{*this, operation{nullptr, -1, 0, timeout}};
+    return awaiter{*this};
+  }
+
+  // operations come in two flavours: by default failures are thrown, the ones
+  // taking std::nothrow return them as result<T> (no exceptions involved)
+  template <typename T> using result = std::expected<T, std::error_code>;
+
+  auto wait_until(std::chrono::time_point<std::chrono::steady_clock> timeout) {
+    return awaiter<void, true>{*this, operation{nullptr, -1, 0, timeout}};
+  }
+
+  auto wait_until(std::chrono::time_point<std::chrono::steady_clock> timeout,
+                  std::nothrow_t) {
+    return awaiter<void, false>{*this, operation{nullptr, -1, 0, timeout}};
   }
 
   template <class Rep, class Period>
   auto wait_for(std::chrono::duration<Rep, Period> timeout_duration) {
-    return wait_until(std::chrono::steady_clock::now() + timeout_duration);
+    return wait_until(now() + timeout_duration);
+  }
+
+  template <class Rep, class Period>
+  auto wait_for(std::chrono::duration<Rep, Period> timeout_duration,
+                std::nothrow_t) {
+    return wait_until(now() + timeout_duration, std::nothrow);
+  }
+
+  template <class Rep, class Period>
+  auto wait_for(std::chrono::duration<Rep, Period> timeout_duration,
+                coarse precision) {
+    return wait_until(coarse_deadline(timeout_duration, precision));
+  }
+
+  template <class Rep, class Period>
+  auto wait_for(std::chrono::duration<Rep, Period> timeout_duration,
+                coarse precision, std::nothrow_t) {
+    return wait_until(coarse_deadline(timeout_duration, precision),
+                      std::nothrow);
   }
 
   auto poll_until(const utils::handle &fd, short events,
                   std::chrono::time_point<std::chrono::steady_clock> timeout) {
-    struct awaiter {
-      io_engine &engine;
-      operation op;
-
-      bool await_ready() const {
-        return std::chrono::steady_clock::now() >= op.timeout;
-      }
-      void await_suspend(std::coroutine_handle<> handle) {
-        op.handle = handle;
-        engine.add_operation(&op);
-      }
-      short await_resume() {
-        if (op.exception)
-          std::rethrow_exception(op.exception);
-        return op.revents;
-      }
-    };
+    return awaiter<short, true>{
+        *this, operation{nullptr, static_cast<int>(fd), events, timeout}};
+  }
 
-    return awaiter{*this,
-                   operation{nullptr, static_cast<int>(fd), events, timeout}};
+  auto poll_until(const utils::handle &fd, short events,
+                  std::chrono::time_point<std::chrono::steady_clock> timeout,
+                  std::nothrow_t) {
+    return awaiter<short, false>{
+        *this, operation{nullptr, static_cast<int>(fd), events, timeout}};
   }
 
   template <class Rep, class Period>
   auto poll_for(const utils::handle &fd, short events,
                 const std::chrono::duration<Rep, Period> &timeout_duration) {
-    return poll_until(fd, events,
-                      std::chrono::steady_clock::now() + timeout_duration);
+    return poll_until(fd, events, now() + timeout_duration);
+  }
+
+  template <class Rep, class Period>
+  auto poll_for(const utils::handle &fd, short events,
+                const std::chrono::duration<Rep, Period> &timeout_duration,
+                std::nothrow_t) {
+    return poll_until(fd, events, now() + timeout_duration, std::nothrow);
+  }
+
+  template <class Rep, class Period>
+  auto poll_for(const utils::handle &fd, short events,
+                const std::chrono::duration<Rep, Period> &timeout_duration,
+                coarse precision) {
+    return poll_until(fd, events, coarse_deadline(timeout_duration, precision));
+  }
+
+  template <class Rep, class Period>
+  auto poll_for(const utils::handle &fd, short events,
+                const std::chrono::duration<Rep, Period> &timeout_duration,
+                coarse precision, std::nothrow_t) {
+    return poll_until(fd, events, coarse_deadline(timeout_duration, precision),
+                      std::nothrow);
+  }
+
+  // deadline rounded up to a multiple of slack (unchanged if it is 0)
+  static std::chrono::steady_clock::time_point
+  round_deadline(std::chrono::steady_clock::time_point deadline,
+                 std::chrono::nanoseconds slack) {
+    using clock = std::chrono::steady_clock;
+    auto ticks = std::chrono::ceil<clock::duration>(slack).count();
+    auto since = deadline.time_since_epoch().count();
+    if (ticks <= 0 || since < 0 ||
+        since > clock::duration::max().count() - ticks)
+      return deadline;
+
+    return clock::time_point(
+        clock::duration((since + ticks - 1) / ticks * ticks));
   }
 
   auto poll(const utils::handle &fd, short events) {
     return poll_until(fd, events, std::chrono::steady_clock::time_point::max());
   }
 
+  auto poll(const utils::handle &fd, short events, std::nothrow_t) {
+    return poll_until(fd, events, std::chrono::steady_clock::time_point::max(),
+                      std::nothrow);
+  }
+
+  // any operation of the engine (wait, poll or async io) made to stop when
+  // stop is requested on token (from any thread), it is unlinked right away
+  // and fails with std::errc::operation_canceled (with io_uring io in flight
+  // fails once the kernel confirmed the cancellation, its buffer may be in
+  // use until then)
+  template <typename Awaiter>
+  static auto stoppable(Awaiter awaiter, std::stop_token token) {
+    return stop_awaiter<Awaiter>{std::move(awaiter), std::move(token)};
+  }
+
+  auto wait_until(std::chrono::time_point<std::chrono::steady_clock> timeout,
+                  std::stop_token token) {
+    return stoppable(wait_until(timeout), std::move(token));
+  }
+
+  auto wait_until(std::chrono::time_point<std::chrono::steady_clock> timeout,
+                  std::stop_token token, std::nothrow_t) {
+    return stoppable(wait_until(timeout, std::nothrow), std::move(token));
+  }
+
+  template <class Rep, class Period>
+  auto wait_for(std::chrono::duration<Rep, Period> timeout_duration,
+                std::stop_token token) {
+    return stoppable(wait_for(timeout_duration), std::move(token));
+  }
+
+  template <class Rep, class Period>
+  auto wait_for(std::chrono::duration<Rep, Period> timeout_duration,
+                std::stop_token token, std::nothrow_t) {
+    return stoppable(wait_for(timeout_duration, std::nothrow),
+                     std::move(token));
+  }
+
+  auto poll_until(const utils::handle &fd, short events,
+                  std::chrono::time_point<std::chrono::steady_clock> timeout,
+                  std::stop_token token) {
+    return stoppable(poll_until(fd, events, timeout), std::move(token));
+  }
+
+  auto poll_until(const utils::handle &fd, short events,
+                  std::chrono::time_point<std::chrono::steady_clock> timeout,
+                  std::stop_token token, std::nothrow_t) {
+    return stoppable(poll_until(fd, events, timeout, std::nothrow),
+                     std::move(token));
+  }
+
+  auto poll(const utils::handle &fd, short events, std::stop_token token) {
+    return stoppable(poll(fd, events), std::move(token));
+  }
+
+  auto poll(const utils::handle &fd, short events, std::stop_token token,
+            std::nothrow_t) {
+    return stoppable(poll(fd, events, std::nothrow), std::move(token));
+  }
+
   // get flags and return immediately
   auto poll_once(const utils::handle &fd) {
-    struct awaiter {
-      io_engine &engine;
-      operation op;
+    return awaiter<short, true>{
+        *this, operation{nullptr, static_cast<int>(fd), 0, {}}, true};
+  }
 
-      bool await_ready() const { return false; }
-      void await_suspend(std::coroutine_handle<> handle) {
-        op.handle = handle;
-        engine.add_operation(&op);
-      }
-      short await_resume() {
-        if (op.exception)
-          std::rethrow_exception(op.exception);
-        return op.revents;
-      }
-    };
+  auto poll_once(const utils::handle &fd, std::nothrow_t) {
+    return awaiter<short, false>{
+        *this, operation{nullptr, static_cast<int>(fd), 0, {}}, true};
+  }
+
+  // completion-based io: submitted directly with the io_uring backend,
+  // attempted right away by the readiness ones which only wait for readiness
+  // (and retry) if it would block, fds have to be non-blocking then
+
+  // (std::nothrow overloads return result<T> of the same value)
+
+  auto async_read(const utils::handle &fd, std::span<std::byte> buffer) {
+    return make_io<op_code::read>(fd, POLLIN, buffer.data(), buffer.size());
+  }
+
+  auto async_read(const utils::handle &fd, std::span<std::byte> buffer,
+                  std::nothrow_t) {
+    return make_io<op_code::read, false>(fd, POLLIN, buffer.data(),
+                                         buffer.size());
+  }
+
+  auto async_write(const utils::handle &fd,
+                   std::span<const std::byte> buffer) {
+    return make_io<op_code::write>(fd, POLLOUT,
+                                   const_cast<std::byte *>(buffer.data()),
+                                   buffer.size());
+  }
+
+  auto async_write(const utils::handle &fd, std::span<const std::byte> buffer,
+                   std::nothrow_t) {
+    return make_io<op_code::write, false>(
+        fd, POLLOUT, const_cast<std::byte *>(buffer.data()), buffer.size());
+  }
+
+  // at offset of a file (its position is left as is), with the readiness
+  // backends regular files are read and written synchronously (they are
+  // always ready), only io_uring overlaps the io with the loop
+  auto async_read_at(const utils::handle &fd, std::span<std::byte> buffer,
+                     off_t offset) {
+    return at_offset(make_io<op_code::read>(fd, POLLIN, buffer.data(),
+                                            buffer.size()),
+                     offset);
+  }
+
+  auto async_read_at(const utils::handle &fd, std::span<std::byte> buffer,
+                     off_t offset, std::nothrow_t) {
+    return at_offset(make_io<op_code::read, false>(fd, POLLIN, buffer.data(),
+                                                   buffer.size()),
+                     offset);
+  }
+
+  auto async_write_at(const utils::handle &fd,
+                      std::span<const std::byte> buffer, off_t offset) {
+    return at_offset(make_io<op_code::write>(
+                         fd, POLLOUT, const_cast<std::byte *>(buffer.data()),
+                         buffer.size()),
+                     offset);
+  }
+
+  auto async_write_at(const utils::handle &fd,
+                      std::span<const std::byte> buffer, off_t offset,
+                      std::nothrow_t) {
+    return at_offset(make_io<op_code::write, false>(
+                         fd, POLLOUT, const_cast<std::byte *>(buffer.data()),
+                         buffer.size()),
+                     offset);
+  }
+
+  // scatter/gather io, the iovecs have to stay valid until it is done (see
+  // write_coalescer to gather separate writes)
+
+  auto async_readv(const utils::handle &fd, std::span<const iovec> iov) {
+    return make_io<op_code::readv>(fd, POLLIN, const_cast<iovec *>(iov.data()),
+                                   iov.size());
+  }
+
+  auto async_readv(const utils::handle &fd, std::span<const iovec> iov,
+                   std::nothrow_t) {
+    return make_io<op_code::readv, false>(
+        fd, POLLIN, const_cast<iovec *>(iov.data()), iov.size());
+  }
+
+  auto async_writev(const utils::handle &fd, std::span<const iovec> iov) {
+    return make_io<op_code::writev>(fd, POLLOUT,
+                                    const_cast<iovec *>(iov.data()),
+                                    iov.size());
+  }
+
+  auto async_writev(const utils::handle &fd, std::span<const iovec> iov,
+                    std::nothrow_t) {
+    return make_io<op_code::writev, false>(
+        fd, POLLOUT, const_cast<iovec *>(iov.data()), iov.size());
+  }
+
+  auto async_recv(const utils::handle &fd, std::span<std::byte> buffer,
+                  int flags = 0) {
+    return make_io<op_code::recv>(fd, POLLIN, buffer.data(), buffer.size(),
+                                  flags);
+  }
+
+  auto async_recv(const utils::handle &fd, std::span<std::byte> buffer,
+                  int flags, std::nothrow_t) {
+    return make_io<op_code::recv, false>(fd, POLLIN, buffer.data(),
+                                         buffer.size(), flags);
+  }
+
+  auto async_send(const utils::handle &fd, std::span<const std::byte> buffer,
+                  int flags = 0) {
+    return make_io<op_code::send>(fd, POLLOUT,
+                                  const_cast<std::byte *>(buffer.data()),
+                                  buffer.size(), flags);
+  }
+
+  auto async_send(const utils::handle &fd, std::span<const std::byte> buffer,
+                  int flags, std::nothrow_t) {
+    return make_io<op_code::send, false>(
+        fd, POLLOUT, const_cast<std::byte *>(buffer.data()), buffer.size(),
+        flags);
+  }
+
+  // returns the accepted socket, always non-blocking (the readiness backends
+  // try io before waiting, a blocking one would stall the engine's thread)
+  auto async_accept(const utils::handle &fd, sockaddr *addr = nullptr,
+                    socklen_t *addrlen = nullptr,
+                    int flags = SOCK_NONBLOCK | SOCK_CLOEXEC) {
+    return make_io<op_code::accept>(fd, POLLIN, addr, 0,
+                                    flags | SOCK_NONBLOCK, addrlen);
+  }
+
+  auto async_accept(const utils::handle &fd, sockaddr *addr,
+                    socklen_t *addrlen, int flags, std::nothrow_t) {
+    return make_io<op_code::accept, false>(fd, POLLIN, addr, 0,
+                                           flags | SOCK_NONBLOCK, addrlen);
+  }
+
+  // fd should be non-blocking with the readiness backends
+  auto async_connect(const utils::handle &fd, const sockaddr *addr,
+                     socklen_t addrlen) {
+    return make_io<op_code::connect>(fd, POLLOUT, const_cast<sockaddr *>(addr),
+                                     addrlen);
+  }
+
+  auto async_connect(const utils::handle &fd, const sockaddr *addr,
+                     socklen_t addrlen, std::nothrow_t) {
+    return make_io<op_code::connect, false>(
+        fd, POLLOUT, const_cast<sockaddr *>(addr), addrlen);
+  }
+
+  // read into a buffer of the pool (options::buffer_count) taken only once
+  // data is there, so idle readers hold no memory, fails with ENOBUFS if the
+  // pool is exhausted
+  auto async_read_pooled(const utils::handle &fd) {
+    return make_io<op_code::read_pooled>(fd, POLLIN, nullptr, buffers.size);
+  }
+
+  auto async_read_pooled(const utils::handle &fd, std::nothrow_t) {
+    return make_io<op_code::read_pooled, false>(fd, POLLIN, nullptr,
+                                                buffers.size);
+  }
+
+  auto async_recv_pooled(const utils::handle &fd, int flags = 0) {
+    return make_io<op_code::recv_pooled>(fd, POLLIN, nullptr, buffers.size,
+                                         flags);
+  }
+
+  auto async_recv_pooled(const utils::handle &fd, int flags, std::nothrow_t) {
+    return make_io<op_code::recv_pooled, false>(fd, POLLIN, nullptr,
+                                                buffers.size, flags);
+  }
+
+  // sends count bytes of in (from *offset which is advanced, or from its
+  // file position if offset is null) to out, with io_uring it waits for out
+  // to be writable and calls sendfile
+  auto async_sendfile(const utils::handle &out, const utils::handle &in,
+                      off_t *offset, std::size_t count) {
+    return make_io<op_code::sendfile>(out, POLLOUT, offset, count,
+                                      static_cast<int>(in));
+  }
 
-    return awaiter{*this, operation{nullptr, static_cast<int>(fd), 0, {}}};
+  auto async_sendfile(const utils::handle &out, const utils::handle &in,
+                      off_t *offset, std::size_t count, std::nothrow_t) {
+    return make_io<op_code::sendfile, false>(out, POLLOUT, offset, count,
+                                             static_cast<int>(in));
   }
 
+  class readiness_stream;
+  class write_coalescer;
+
+  // events of fd as they come, without registering it for every one of them
+  readiness_stream readiness(const utils::handle &fd, short events);
+
+  // counters and histograms of the engine, can be read from any thread (all
+  // zero unless built with CORO_ASYNCIO_METRICS)
+  io_engine_metrics metrics() const { return stats.read(); }
+
+  // coroutines waiting on an operation of the engine (not those in the run
+  // queues or waiting on a mutex or channel) with the tasks awaiting them,
+  // called by the engine's thread (e.g. from a coroutine, for write_stacks)
+  std::vector<suspended_coroutine> suspended() const;
+
   struct poll_error : std::runtime_error {
     poll_error(std::string what, int fd)
         : std::runtime_error(what + " on " + std::to_string(fd)), fd(fd) {}
@@ -475,6 +1324,54 @@ public:
   };
 
 private:
+  // entry of the (intrusive) list of posted coroutines
+  struct operation;
+
+  struct posted_node {
+    std::coroutine_handle<> handle;
+    posted_node *next = nullptr;
+    // allocated by post(handle)
+    bool owned = false;
+    // the node asks to cancel this operation (instead of resuming handle)
+    operation *cancelled = nullptr;
+    // run queue handle goes to
+    priority lane = priority::normal;
+  };
+
+  // shared by a stoppable operation and its stop callback (which may run on
+  // another thread), whoever leaves waiting first decides how it ends: the
+  // callback posts node and the engine resumes the operation once it is
+  // taken (even if it finished meanwhile)
+  struct cancel_state {
+    enum : std::uint8_t { waiting, requested, done };
+
+    std::atomic<std::uint8_t> state = waiting;
+    basic_io_engine *engine = nullptr;
+    posted_node node;
+
+    void request() noexcept {
+      std::uint8_t expected = waiting;
+      if (state.compare_exchange_strong(expected, requested,
+                                        std::memory_order_acq_rel))
+        engine->post(&node);
+    }
+  };
+
+  enum class op_code : std::uint8_t {
+    poll,
+    read,
+    write,
+    recv,
+    send,
+    accept,
+    connect,
+    sendfile,
+    read_pooled,
+    recv_pooled,
+    readv,
+    writev,
+  };
+
   struct operation {
     std::coroutine_handle<> handle;
     int fd;
@@ -482,12 +1379,603 @@ private:
     std::chrono::time_point<std::chrono::steady_clock> timeout;
 
     short revents = 0;
-    std::exception_ptr exception = nullptr;
+    std::error_code error;
+
+    // arguments of completion-based io (sendfile passes its offset as buffer
+    // and input fd as flags)
+    op_code code = op_code::poll;
+    void *buffer = nullptr;
+    std::size_t length = 0;
+    int flags = 0;
+    socklen_t *addrlen = nullptr;
+    // of read and write, -1 uses (and advances) the file position
+    off_t offset = -1;
+
+    // syscall return value (or -errno)
+    int result = 0;
+    // pool buffer holding the data of a pooled read
+    int buffer_id = -1;
+    bool completed = false;
+
+    // io_uring submission tag (0 if nothing is in flight)
+    std::uint64_t user_data = 0;
+
+    // position in the timer heap
+    std::size_t timer_index = detail::timer_heap<operation>::npos;
+    // position in operations
+    std::size_t index = 0;
+    // is in the ready list
+    bool queued = false;
+    // class of the awaiting coroutine (its run queue)
+    priority lane = priority::normal;
+    // its task and the time it suspended (tracing only)
+    [[no_unique_address]] detail::operation_trace trace;
+    // set for stoppable operations
+    cancel_state *stop = nullptr;
+    // stays registered between events (readiness_stream), cleared once the
+    // engine let go of it
+    bool multishot = false;
   };
 
-  void add_operation(operation *op);
-  void do_pull(std::function<int(std::span<pollfd>)> poll_fn);
+  // op is awaited by the coroutine of handle: its class and task
+  template <typename P>
+  static void awaited_by(operation &op, std::coroutine_handle<P> handle) {
+    op.lane = detail::priority_of(handle);
+    if constexpr (tracing_enabled)
+      op.trace.frame = detail::trace_frame_of(handle);
+  }
+
+  // T is void for timers and short (revents) for polls
+  template <typename T, bool Throw> struct awaiter {
+    basic_io_engine &engine;
+    operation op;
+    // poll_once has to go through the engine even though its deadline passed
+    bool once = false;
+
+    bool await_ready() const {
+      return !once && engine.now() >= op.timeout;
+    }
+    template <typename P> void await_suspend(std::coroutine_handle<P> handle) {
+      op.handle = handle;
+      awaited_by(op, handle);
+      engine.add_operation(&op);
+    }
+    auto await_resume() {
+      if constexpr (Throw) {
+        if (op.error)
+          throw_error(op.error, op);
+
+        if constexpr (!std::is_void_v<T>)
+          return op.revents;
+      } else {
+        if (op.error)
+          return result<T>(std::unexpect, op.error);
+
+        if constexpr (std::is_void_v<T>)
+          return result<T>();
+        else
+          return result<T>(op.revents);
+      }
+    }
+  };
+
+  template <typename Awaiter> struct stop_awaiter : Awaiter {
+    struct callback {
+      cancel_state *stop;
+      void operator()() noexcept { stop->request(); }
+    };
+
+    std::stop_token token;
+    cancel_state stop;
+    std::optional<std::stop_callback<callback>> registration;
+
+    bool await_ready() {
+      if (token.stop_requested()) {
+        this->op.error = std::make_error_code(std::errc::operation_canceled);
+        return true;
+      }
 
+      return Awaiter::await_ready();
+    }
+    template <typename P> void await_suspend(std::coroutine_handle<P> handle) {
+      stop.engine = &this->engine;
+      stop.node.cancelled = &this->op;
+      this->op.stop = &stop;
+      Awaiter::await_suspend(handle);
+      // may run the callback right away
+      registration.emplace(token, callback{&stop});
+    }
+    auto await_resume() {
+      // waits for a callback running on another thread
+      registration.reset();
+      return Awaiter::await_resume();
+    }
+  };
+
+  struct schedule_awaiter {
+    basic_io_engine &engine;
+    posted_node node;
+
+    bool await_ready() const { return false; }
+    template <typename P> void await_suspend(std::coroutine_handle<P> handle) {
+      node.handle = handle;
+      node.lane = detail::priority_of(handle);
+      engine.post(&node);
+    }
+    void await_resume() {}
+  };
+
+  template <op_code Code>
+  static auto io_value(basic_io_engine &engine, const operation &op) {
+    if constexpr (Code == op_code::read_pooled ||
+                  Code == op_code::recv_pooled)
+      return op.buffer_id < 0
+                 ? buffer_lease()
+                 : buffer_lease(engine, static_cast<std::uint16_t>(op.buffer_id),
+                                static_cast<std::size_t>(op.result));
+    else if constexpr (Code == op_code::accept)
+      return utils::handle(op.result);
+    else if constexpr (Code == op_code::connect)
+      return;
+    else
+      return static_cast<std::size_t>(op.result);
+  }
+
+  template <op_code Code, bool Throw> struct io_awaiter {
+    basic_io_engine &engine;
+    operation op;
+
+    bool await_ready() { return engine.try_complete(&op); }
+    template <typename P> void await_suspend(std::coroutine_handle<P> handle) {
+      op.handle = handle;
+      awaited_by(op, handle);
+      engine.add_operation(&op);
+    }
+    auto await_resume() {
+      if (!op.error && op.result < 0)
+        op.error = std::error_code(-op.result, std::system_category());
+
+      using T = decltype(io_value<Code>(engine, op));
+      if constexpr (Throw) {
+        if (op.error)
+          throw_error(op.error, op);
+
+        return io_value<Code>(engine, op);
+      } else {
+        if (op.error)
+          return result<T>(std::unexpect, op.error);
+
+        if constexpr (std::is_void_v<T>)
+          return result<T>();
+        else
+          return result<T>(io_value<Code>(engine, op));
+      }
+    }
+  };
+
+  template <op_code Code, bool Throw = true>
+  io_awaiter<Code, Throw> make_io(const utils::handle &fd, short events,
+                                  void *buffer, std::size_t length,
+                                  int flags = 0, socklen_t *addrlen = nullptr) {
+    operation op{nullptr, static_cast<int>(fd), events,
+                 std::chrono::steady_clock::time_point::max()};
+    op.code = Code;
+    op.buffer = buffer;
+    // results have to fit into an int (partial transfers are allowed)
+    op.length = std::min<std::size_t>(length, INT32_MAX);
+    op.flags = flags;
+    op.addrlen = addrlen;
+    return {*this, op};
+  }
+
+  template <typename Awaiter>
+  static Awaiter at_offset(Awaiter io, off_t offset) {
+    io.op.offset = offset;
+    return io;
+  }
+
+  // exception matching the error of a finished operation
+  [[noreturn]] static void throw_error(std::error_code error,
+                                       const operation &op);
+  static const char *op_name(op_code code);
+  // op_name, "timer" for plain timers
+  static const char *trace_name(const operation &op) {
+    return op.fd == -1 && op.code == op_code::poll ? "timer" : op_name(op.code);
+  }
+
+  /*
+  per-fd state of the readiness backends, kept in registrations (indexed by
+  the fd number): all waiters of an fd share one pollfd / epoll registration
+  with the union of their events and revents are handed to each of them.
+  epoll registers the fd with EPOLLONESHOT so it is disarmed by the kernel
+  after every report and re-armed (EPOLL_CTL_MOD), EPOLLET instead if all
+  waiters are streams
+  */
+  struct registration {
+    std::vector<operation *> waiters;
+    bool registered = false;
+    // only streams wait, the fd is edge-triggered and stays armed
+    bool edge = false;
+    // position in pollfds (poll backend)
+    std::size_t slot = npos;
+
+    static constexpr std::size_t npos = -1;
+  };
+
+  void add_operation(operation *op);
+  // run io without waiting if the fd is ready already (connect is started),
+  // false means it has to be added
+  bool try_complete(operation *op);
+  void do_pull(bool block);
+
+  // decide if operation is done (runs readiness-driven io)
+  bool finish(operation *op, std::chrono::steady_clock::time_point now,
+              std::error_code error);
+  void post(posted_node *node);
+  void take_posted();
+  // async_mutex, async_semaphore and channel hand waiters over with
+  // resume_later (same thread, resumed by the running pull) and post (other
+  // threads)
+  friend detail::sync_access;
+  void resume_later(std::coroutine_handle<> handle, priority lane) {
+    run_queues[static_cast<std::size_t>(lane)].push_back(handle);
+  }
+  // anything in the run queues
+  bool runnable() const {
+    return std::ranges::any_of(run_queues,
+                               [](auto &queue) { return !queue.empty(); });
+  }
+  // handle a cancellation taken from posted
+  void cancel_operation(operation *op);
+  void run_ready();
+  // resume a coroutine taken from the run queues (or end_queue)
+  void run(std::coroutine_handle<> handle);
+  // record the suspension of the coroutine awaiting op (tracing only)
+  void trace_suspend(operation *op);
+  void arm_wakeup();
+  // nothing (besides the wakeup) waits in the engine
+  bool empty() const;
+
+  // queue operation to be checked by the next pull
+  void make_ready(operation *op);
+  void remove_operation(operation *op);
+  // drop the backend state of a finished operation
+  void detach(operation *op);
+  // run io of a ready operation on behalf of the readiness backends
+  int perform(operation *op);
+  // readiness_stream operations are registered once, they are parked while
+  // nobody awaits them (events are kept in revents meanwhile)
+  void add_stream(operation *op);
+  void park(operation *op);
+  void unpark(operation *op, std::coroutine_handle<> handle);
+  void drop_stream(operation *op);
+  // resume the awaiter of a stream that got events
+  void deliver(operation *op, std::error_code error);
+  // how a finished operation ended, for the metrics
+  static detail::operation_outcome outcome(const operation &op);
+  // io_uring waits for readiness of these and calls perform
+  bool polled(const operation *op) const;
+
+  // time left until the nearest deadline (none if there are no timers)
+  std::optional<std::chrono::nanoseconds> wait_timeout() const;
+  std::chrono::steady_clock::time_point read_clock() const;
+
+  // wait with the backend (returns -1 with errno on failure)
+  int wait(bool block);
+  // busy poll, then block if nothing arrived within the window
+  int spin_wait();
+  // anything for the pull to handle
+  bool arrived() const;
+
+  // wait for readiness and store it in revents of waiting operations
+  int wait_poll(bool block);
+  int wait_epoll(bool block);
+  int wait_uring(bool block);
+
+  void arm(int fd, registration &reg);
+  // registration of fd, nullptr if nothing waited on it yet
+  registration *find_registration(int fd);
+  // add/remove op to the waiters of its fd (readiness backends)
+  void register_waiter(operation *op);
+  void unregister_waiter(operation *op);
+  // set the pollfd of fd to the events of its waiters that are not parked
+  // (dropped if it has no waiters left)
+  void update_pollfd(int fd, registration &reg);
+  // hand revents reported for an fd to its waiters
+  void dispatch(registration &reg, short revents);
+
+  // options::kind, ignored with static_backend
+  backend kind;
+  // operations waiting on fds (or io completions)
   std::vector<operation *> operations;
+  // all operations with a deadline (timer-only ones are kept only here)
+  TimerQueue<operation> timers;
+  // per-fd state (indexed by the fd number), see registration
+  std::vector<registration> registrations;
+  // one for every fd with waiters, poll backend only (fd is -1 while all of
+  // them are parked, polled_fds keeps it)
+  std::vector<pollfd> pollfds;
+  std::vector<int> polled_fds;
+
+  // operations reported by the backend (or expired) since the last pull
+  std::vector<operation *> ready;
+  // coroutines to resume, one FIFO per priority taking weighted turns (at
+  // most resume_budget per pull)
+  std::array<detail::ring_buffer<std::coroutine_handle<>>, priority_count>
+      run_queues;
+  std::array<std::size_t, priority_count> priority_weights;
+  // class whose turn it is and what is left of it
+  std::size_t turn = priority_count - 1;
+  std::size_t turn_left = 0;
+  // class of the coroutine resumed last from the run queues
+  priority running_lane = priority::normal;
+  // coroutines waiting with defer for the end of the pull
+  detail::ring_buffer<std::coroutine_handle<>> end_queue;
+  std::size_t resume_budget;
+  std::size_t inline_budget;
+  // io the running coroutine may still do without waiting
+  std::size_t inline_left;
+  std::chrono::nanoseconds busy_poll;
+  std::chrono::nanoseconds timer_slack;
+  clock_source clock;
+  // engine whose pull runs on this thread
+  static inline thread_local basic_io_engine *running = nullptr;
+  // set while pulling, when current_time is the time sampled by the pull
+  bool pulling = false;
+  std::chrono::steady_clock::time_point current_time;
+  // moving average of the time blocking pulls waited for an arrival
+  std::chrono::nanoseconds arrival_gap;
+
+  template <class Rep, class Period>
+  std::chrono::steady_clock::time_point
+  coarse_deadline(std::chrono::duration<Rep, Period> timeout_duration,
+                  coarse precision) const {
+    auto slack = precision.slack;
+    if (slack == std::chrono::nanoseconds::zero()) {
+      auto bucket = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        timeout_duration)
+                        .count() /
+                    16;
+      if (bucket > 0)
+        slack = std::chrono::nanoseconds(
+            std::bit_floor(static_cast<std::uint64_t>(bucket)));
+    }
+
+    // a multiple of timer_slack, so add_operation keeps the deadline as is
+    if (timer_slack.count() > 0)
+      slack = std::max(slack, timer_slack) / timer_slack * timer_slack;
+
+    return round_deadline(now() + timeout_duration, slack);
+  }
+
+  // lock-free stack pushed by other threads, taken all at once by the pull
+  std::atomic<posted_node *> posted = nullptr;
+  // finished stoppable operations whose cancellation is being posted (they
+  // are resumed when it is taken)
+  std::size_t deferred = 0;
+  // streams nobody awaits, they do not keep pull_all running
+  std::size_t parked = 0;
+  // readable when something was posted (or wake was called)
+  utils::handle wake_fd;
+  operation wake_op;
+
+  utils::handle epfd;
+  std::vector<epoll_event> epoll_events;
+  std::vector<int> fired;
+  // nanosecond timeouts need linux 5.11
+  bool epoll_pwait2_supported = true;
+
+  // false if no submission entry could be had (op->error is set)
+  bool submit(operation *op);
+  void cancel(operation *op);
+  void submit_cancel(std::uint64_t user_data);
+  void resubmit_cancels();
+  void reap();
+  io_uring_sqe *get_sqe();
+  std::uint64_t acquire_slot(operation *op);
+  operation *release_slot(std::uint64_t user_data);
+  // operation of a slot that stays in flight (multishot) or nullptr
+  operation *slot_operation(std::uint64_t user_data) const;
+
+  // in-flight operations are tagged with slot index and generation so late
+  // completions of abandoned submissions can be recognized
+  struct slot {
+    operation *op = nullptr;
+    std::uint32_t generation = 1;
+  };
+
+  std::unique_ptr<detail::uring> ring;
+  std::vector<slot> slots;
+  std::vector<std::uint32_t> free_slots;
+  // cancellations that found the submission queue full and io_uring_enter
+  // failing, submitted again by the next wait
+  std::vector<std::uint64_t> unsent_cancels;
+
+  void setup_buffers(std::size_t count, std::size_t size);
+  void release_buffer(std::uint16_t id);
+  // is the buffer within the pool (registered with io_uring)
+  bool fixed_buffer(const void *buffer, std::size_t length) const;
+
+  // buffers of pooled reads, io_uring picks them from a provided buffer ring
+  // (if the kernel supports it), the others from the free list
+  struct buffer_pool {
+    std::byte *base = nullptr;
+    std::size_t size = 0;
+    std::size_t mapped = 0;
+    std::vector<std::uint16_t> free;
+
+    io_uring_buf_ring *ring = nullptr;
+    std::size_t ring_mapped = 0;
+    std::uint16_t ring_mask = 0;
+    std::uint16_t ring_tail = 0;
+    // registered with io_uring as a fixed buffer
+    bool fixed = false;
+  } buffers;
+
+  // empty when metrics are compiled out
+  [[no_unique_address]] Stats stats;
 };
-} // namespace coro
\ No newline at end of file
+
+/*
+registration of an fd that outlives single events: awaiting next() costs no
+registration (edge-triggered epoll, multishot poll with io_uring), events
+arriving while nobody awaits are merged and returned by the next call right
+away (the poll backend does not watch the fd meanwhile, its next pull reports
+them)
+
+events are reported when the fd becomes ready (the poll backend reports them
+as long as it is), so read or write until EAGAIN before awaiting the next
+ones; errors stay (every later call reports them)
+
+it has to be destroyed on the engine's thread, while no coroutine awaits it
+*/
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+class basic_io_engine<Backend, TimerQueue, Stats>::readiness_stream {
+public:
+  readiness_stream(const readiness_stream &) = delete;
+  readiness_stream &operator=(const readiness_stream &) = delete;
+
+  ~readiness_stream() {
+    if (op.multishot)
+      engine.drop_stream(&op);
+  }
+
+  // revents since the last call (throws the errors of poll)
+  auto next() { return next_awaiter<true>{*this}; }
+  auto next(std::nothrow_t) { return next_awaiter<false>{*this}; }
+
+private:
+  friend basic_io_engine;
+
+  readiness_stream(basic_io_engine &engine, int fd, short events)
+      : engine(engine),
+        op{nullptr, fd, events, std::chrono::steady_clock::time_point::max()} {
+    if (fd == -1)
+      op.error = std::error_code(EBADF, std::system_category());
+    else
+      engine.add_stream(&op);
+  }
+
+  template <bool Throw> struct next_awaiter {
+    readiness_stream &stream;
+
+    bool await_ready() const {
+      return stream.op.error ||
+             (stream.op.revents &
+              (stream.op.events | POLLERR | POLLHUP | POLLNVAL));
+    }
+    template <typename P> void await_suspend(std::coroutine_handle<P> handle) {
+      awaited_by(stream.op, handle);
+      stream.engine.unpark(&stream.op, handle);
+    }
+    auto await_resume() {
+      auto &op = stream.op;
+      if constexpr (Throw) {
+        if (op.error)
+          throw_error(op.error, op);
+
+        return std::exchange(op.revents, 0);
+      } else {
+        if (op.error)
+          return result<short>(std::unexpect, op.error);
+
+        return result<short>(std::exchange(op.revents, 0));
+      }
+    }
+  };
+
+  basic_io_engine &engine;
+  operation op;
+};
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+auto basic_io_engine<Backend, TimerQueue, Stats>::readiness(
+    const utils::handle &fd, short events) -> readiness_stream {
+  return {*this, static_cast<int>(fd), events};
+}
+
+/*
+gathers the writes to an fd queued during a pull of the engine and flushes
+them once the coroutines of the pull ran, with as few writev (sendmsg for
+sockets) calls as possible; a write completes when all of its data was
+written, it is not copied so it has to stay valid until then
+
+writes go out in order, when one fails all the queued ones fail with it, the
+coalescer has to be destroyed on the engine's thread while no write is queued
+*/
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+class basic_io_engine<Backend, TimerQueue, Stats>::write_coalescer {
+public:
+  write_coalescer(basic_io_engine &engine, const utils::handle &fd)
+      : engine(engine), fd(fd) {}
+  write_coalescer(const write_coalescer &) = delete;
+  write_coalescer &operator=(const write_coalescer &) = delete;
+
+  auto write(std::span<const std::byte> data) {
+    return write_awaiter<true>{*this, {data}};
+  }
+
+  auto write(std::span<const std::byte> data, std::nothrow_t) {
+    return write_awaiter<false>{*this, {data}};
+  }
+
+private:
+  // queued write, kept by its awaiter
+  struct entry {
+    std::span<const std::byte> data;
+    std::size_t written = 0;
+    std::coroutine_handle<> handle;
+    priority lane = priority::normal;
+    std::error_code error;
+    entry *next = nullptr;
+  };
+
+  template <bool Throw> struct write_awaiter {
+    write_coalescer &out;
+    entry e;
+
+    bool await_ready() const { return e.data.empty(); }
+    template <typename P> void await_suspend(std::coroutine_handle<P> handle) {
+      e.handle = handle;
+      e.lane = detail::priority_of(handle);
+      out.push(&e);
+    }
+    auto await_resume() {
+      if constexpr (Throw) {
+        if (e.error)
+          throw std::system_error(e.error, "writev");
+
+        return e.written;
+      } else {
+        if (e.error)
+          return result<std::size_t>(std::unexpect, e.error);
+
+        return result<std::size_t>(e.written);
+      }
+    }
+  };
+
+  void push(entry *e);
+  // write as much of the queue as the fd takes, false if it would block
+  bool flush();
+  void fail(std::error_code error);
+  // writes until the queue is empty, started by the first queued write
+  eager_task<void> drain();
+
+  basic_io_engine &engine;
+  const utils::handle &fd;
+  entry *head = nullptr;
+  entry *tail = nullptr;
+  std::optional<eager_task<void>> flusher;
+  bool flushing = false;
+  // sendmsg failed with ENOTSOCK, use writev
+  bool plain = false;
+};
+
+// the engine built with the library
+using io_engine = basic_io_engine<>;
+extern template class basic_io_engine<>;
+} // namespace coro
@@ -0,0 +1,1722 @@
+#pragma once
+
+// definitions of basic_io_engine, needed by the translation unit
+// instantiating a configuration of it (io_engine is in the library)
+
+#include "io_engine.hpp"
+#include "io_engine_pool.hpp"
+#include "uring.hpp"
+
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <climits>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace coro {
+
+namespace detail {
+inline timespec to_timespec(std::chrono::nanoseconds duration) {
+  auto sec = std::chrono::duration_cast<std::chrono::seconds>(duration);
+  return timespec{static_cast<time_t>(sec.count()),
+                  static_cast<long>((duration - sec).count())};
+}
+} // namespace detail
+
+// epoll reports events with the same bit values as poll on linux
+static_assert(EPOLLIN == POLLIN && EPOLLOUT == POLLOUT &&
+              EPOLLPRI == POLLPRI && EPOLLERR == POLLERR &&
+              EPOLLHUP == POLLHUP && EPOLLRDHUP == POLLRDHUP);
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+basic_io_engine<Backend, TimerQueue, Stats>::basic_io_engine(options opts)
+    : kind(opts.kind), priority_weights(opts.priority_weights),
+      resume_budget(opts.resume_budget), inline_budget(opts.inline_budget),
+      inline_left(opts.inline_budget), busy_poll(opts.busy_poll),
+      timer_slack(opts.timer_slack), clock(opts.clock),
+      current_time(std::chrono::steady_clock::now()),
+      arrival_gap(opts.busy_poll / 2) {
+  if (backend_kind() == backend::epoll) {
+    epfd = utils::handle(::epoll_create1(EPOLL_CLOEXEC));
+    if (!epfd)
+      utils::throw_sys_error("epoll_create1");
+
+    epoll_events.resize(64);
+  } else if (backend_kind() == backend::io_uring) {
+    unsigned idle = 0;
+    if (opts.sqpoll)
+      idle = static_cast<unsigned>(std::max<long long>(
+          std::chrono::ceil<std::chrono::milliseconds>(busy_poll).count(), 1));
+    ring = std::make_unique<detail::uring>(256, idle);
+  }
+
+  if (opts.buffer_count)
+    setup_buffers(opts.buffer_count, opts.buffer_size);
+
+  wake_fd = utils::handle(::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK));
+  if (!wake_fd)
+    utils::throw_sys_error("eventfd");
+
+  arm_wakeup();
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+basic_io_engine<Backend, TimerQueue, Stats>::~basic_io_engine() {
+  detach(&wake_op);
+
+  if (ring) {
+    // the kernel may still use buffers of in-flight operations, so wait for
+    // all of them to be cancelled before resuming the waiters
+    for (auto *op : operations) {
+      if (op->user_data)
+        submit_cancel(op->user_data);
+    }
+
+    while (std::ranges::any_of(operations,
+                               [](operation *op) { return op->user_data; })) {
+      resubmit_cancels();
+      int ret = ring->enter(1);
+      if (ret < 0 && ret != -EBUSY)
+        break;
+      reap();
+    }
+  }
+
+  std::error_code error = io_errc::engine_destroyed;
+  auto destroy = [&](operation *op) {
+    op->error = error;
+    // streams are left alone by their destructor now
+    if (std::exchange(op->multishot, false) && !op->handle)
+      return;
+
+    // its cancellation is being posted, it is resumed when taken
+    if (op->stop && op->stop->state.exchange(cancel_state::done,
+                                             std::memory_order_acq_rel) ==
+                        cancel_state::requested) {
+      ++deferred;
+      return;
+    }
+
+    op->handle.resume();
+  };
+
+  while (!timers.empty()) {
+    auto *op = timers.pop();
+    if (op->fd == -1)
+      destroy(op);
+  }
+
+  while (!operations.empty()) {
+    auto *op = operations.back();
+    operations.pop_back();
+    destroy(op);
+  }
+
+  // also waits for cancellations other threads are posting
+  do {
+    take_posted();
+    while (runnable() || !end_queue.empty()) {
+      auto *queue = &end_queue;
+      for (auto &lane : run_queues)
+        if (!lane.empty()) {
+          queue = &lane;
+          break;
+        }
+      queue->pop_front().resume();
+    }
+
+    if (deferred)
+      std::this_thread::yield();
+  } while (deferred);
+
+  if (buffers.ring) {
+    io_uring_buf_reg reg{};
+    ring->register_resource(IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    ::munmap(buffers.ring, buffers.ring_mapped);
+  }
+  if (buffers.fixed)
+    ring->register_resource(IORING_UNREGISTER_BUFFERS, nullptr, 0);
+  if (buffers.base)
+    ::munmap(buffers.base, buffers.mapped);
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+const char *
+basic_io_engine<Backend, TimerQueue, Stats>::op_name(op_code code) {
+  switch (code) {
+  case op_code::poll:
+    return "poll";
+  case op_code::read:
+    return "read";
+  case op_code::write:
+    return "write";
+  case op_code::recv:
+    return "recv";
+  case op_code::send:
+    return "send";
+  case op_code::accept:
+    return "accept";
+  case op_code::connect:
+    return "connect";
+  case op_code::sendfile:
+    return "sendfile";
+  case op_code::read_pooled:
+    return "read";
+  case op_code::recv_pooled:
+    return "recv";
+  case op_code::readv:
+    return "readv";
+  case op_code::writev:
+    return "writev";
+  }
+
+  return "io";
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+int basic_io_engine<Backend, TimerQueue, Stats>::perform(operation *op) {
+  ssize_t ret = -1;
+  switch (op->code) {
+  case op_code::read:
+    ret = op->offset < 0 ? ::read(op->fd, op->buffer, op->length)
+                         : ::pread(op->fd, op->buffer, op->length, op->offset);
+    break;
+  case op_code::write:
+    ret = op->offset < 0 ? ::write(op->fd, op->buffer, op->length)
+                         : ::pwrite(op->fd, op->buffer, op->length, op->offset);
+    break;
+  // (never blocks even if the socket does)
+  case op_code::recv:
+    ret = ::recv(op->fd, op->buffer, op->length, op->flags | MSG_DONTWAIT);
+    break;
+  case op_code::send:
+    ret = ::send(op->fd, op->buffer, op->length, op->flags | MSG_DONTWAIT);
+    break;
+  case op_code::accept:
+    ret = ::accept4(op->fd, static_cast<sockaddr *>(op->buffer), op->addrlen,
+                    op->flags);
+    break;
+  case op_code::connect: {
+    // connect was started on submission, fetch its outcome
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (::getsockopt(op->fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1)
+      return -errno;
+    return -err;
+  }
+  case op_code::sendfile:
+    ret = ::sendfile(op->fd, op->flags, static_cast<off_t *>(op->buffer),
+                     op->length);
+    break;
+  case op_code::readv:
+    ret = ::readv(op->fd, static_cast<iovec *>(op->buffer),
+                  static_cast<int>(op->length));
+    break;
+  case op_code::writev:
+    ret = ::writev(op->fd, static_cast<iovec *>(op->buffer),
+                   static_cast<int>(op->length));
+    break;
+  case op_code::read_pooled:
+  case op_code::recv_pooled: {
+    // idle fds (tried before waiting) do not need a buffer yet
+    if (buffers.free.empty())
+      return op->revents ? -ENOBUFS : -EAGAIN;
+
+    // the buffer is only taken if there is data
+    std::uint16_t id = buffers.free.back();
+    std::byte *buffer = buffers.base + id * buffers.size;
+    if (op->code == op_code::read_pooled)
+      ret = ::read(op->fd, buffer, buffers.size);
+    else
+      ret = ::recv(op->fd, buffer, buffers.size, op->flags | MSG_DONTWAIT);
+
+    if (ret > 0) {
+      buffers.free.pop_back();
+      op->buffer_id = id;
+    }
+    break;
+  }
+  case op_code::poll:
+    assert(false);
+    break;
+  }
+
+  return ret < 0 ? -errno : static_cast<int>(ret);
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+detail::operation_outcome basic_io_engine<Backend, TimerQueue, Stats>::outcome(
+    const operation &op) {
+  using enum detail::operation_outcome;
+
+  if (op.error)
+    return failed;
+  if (op.fd == -1)
+    return timer;
+  // io_uring submissions are cancelled by the kernel
+  if (op.completed && op.code != op_code::poll && op.result == -ECANCELED)
+    return cancelled;
+  if (op.completed || op.revents)
+    return ready;
+  return timed_out;
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+void basic_io_engine<Backend, TimerQueue, Stats>::throw_error(
+    std::error_code error, const operation &op) {
+  if (error.category() == io_category()) {
+    switch (static_cast<io_errc>(error.value())) {
+    case io_errc::pollerr:
+      throw pollerr_error(op.fd);
+    case io_errc::pollhup:
+      throw pollhup_error(op.fd);
+    case io_errc::pollnval:
+      throw pollnval_error(op.fd);
+    case io_errc::engine_destroyed:
+      throw std::runtime_error("io_engine destroyed");
+    }
+  }
+
+  throw std::system_error(error, op_name(op.code));
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+std::optional<std::chrono::nanoseconds>
+basic_io_engine<Backend, TimerQueue, Stats>::wait_timeout() const {
+  // some operations were completed without waiting
+  if (!ready.empty() || runnable() || !end_queue.empty() ||
+      posted.load(std::memory_order_relaxed))
+    return std::chrono::nanoseconds::zero();
+
+  if (timers.empty())
+    return std::nullopt;
+
+  return std::max(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      timers.top()->timeout - read_clock()),
+                  std::chrono::nanoseconds::zero());
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+std::chrono::steady_clock::time_point
+basic_io_engine<Backend, TimerQueue, Stats>::read_clock() const {
+  switch (clock) {
+  case clock_source::steady:
+    break;
+  case clock_source::coarse: {
+    // steady_clock is CLOCK_MONOTONIC, the coarse one counts from the same
+    // origin
+    timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return std::chrono::steady_clock::time_point(
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::seconds(ts.tv_sec) +
+            std::chrono::nanoseconds(ts.tv_nsec)));
+  }
+  case clock_source::manual:
+    return current_time;
+  }
+
+  return std::chrono::steady_clock::now();
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+void basic_io_engine<Backend, TimerQueue, Stats>::advance(
+    std::chrono::nanoseconds duration) {
+  if (clock != clock_source::manual)
+    throw std::logic_error("io_engine clock is not manual");
+
+  current_time += duration;
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+void basic_io_engine<Backend, TimerQueue, Stats>::do_pull(bool block) {
+  // pulls may nest (a coroutine pulling another engine)
+  struct running_guard {
+    basic_io_engine &engine;
+    basic_io_engine *previous;
+    bool pulling;
+    ~running_guard() {
+      running = previous;
+      engine.pulling = pulling;
+    }
+  } guard{*this, std::exchange(running, this), std::exchange(pulling, true)};
+
+  stats.pulled(operations.size(), timers.size());
+
+  auto waiting = stats.now();
+  int ret;
+  if (block && clock == clock_source::manual && !timers.empty()) {
+    // waiting would not bring the deadlines closer, the clock jumps to the
+    // nearest one unless something else is there to run
+    ret = wait(false);
+    if (auto timeout = wait_timeout();
+        ret != -1 && !arrived() && timeout && timeout->count() > 0)
+      current_time = timers.top()->timeout;
+  } else {
+    ret = block && busy_poll.count() ? spin_wait() : wait(block);
+  }
+  stats.waited(waiting);
+
+  // throw error on all waiting tasks (only those that use file descriptors)
+  std::error_code error;
+  if (ret == -1) {
+    error = std::error_code(errno, std::system_category());
+    for (auto *op : operations)
+      make_ready(op);
+  }
+
+  current_time = read_clock();
+  auto now = current_time;
+
+  // expired fd waiters are dropped by finish
+  while (!timers.empty() && timers.top()->timeout <= now) {
+    operation *op = timers.pop();
+    stats.late(now - op->timeout);
+    make_ready(op);
+  }
+
+  bool woken = false;
+
+  for (auto *op : ready) {
+    op->queued = false;
+    if (op->multishot) {
+      deliver(op, error);
+      continue;
+    }
+
+    if (!finish(op, now, error))
+      continue;
+
+    detach(op);
+    if (op != &wake_op)
+      stats.finished(outcome(*op));
+
+    if (op == &wake_op)
+      woken = true;
+    else if (!op->stop || op->stop->state.exchange(
+                              cancel_state::done,
+                              std::memory_order_acq_rel) !=
+                              cancel_state::requested)
+      resume_later(op->handle, op->lane);
+    else
+      // resumed once its cancellation is taken
+      ++deferred;
+  }
+  ready.clear();
+
+  if (woken) {
+    std::uint64_t value;
+    [[maybe_unused]] auto n =
+        ::read(static_cast<int>(wake_fd), &value, sizeof(value));
+    arm_wakeup();
+  }
+
+  if (backend_kind() == backend::epoll) {
+    // reported fds were disarmed by the kernel, re-arm those that still have
+    // waiters
+    for (int fd : fired) {
+      auto *reg = find_registration(fd);
+      if (reg && !reg->waiters.empty() && !reg->edge)
+        arm(fd, *reg);
+    }
+    fired.clear();
+  }
+
+  take_posted();
+  run_ready();
+
+  // only those deferred so far, deferring again waits for the next pull
+  for (std::size_t count = end_queue.size(); count > 0; --count) {
+    inline_left = inline_budget;
+    run(end_queue.pop_front());
+  }
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+int basic_io_engine<Backend, TimerQueue, Stats>::wait(bool block) {
+  switch (backend_kind()) {
+  case backend::poll:
+    return wait_poll(block);
+  case backend::epoll:
+    return wait_epoll(block);
+  case backend::io_uring:
+    return wait_uring(block);
+  }
+
+  return 0;
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+int basic_io_engine<Backend, TimerQueue, Stats>::spin_wait() {
+  auto timeout = wait_timeout();
+  if (timeout && *timeout == std::chrono::nanoseconds::zero())
+    return wait(false);
+
+  // spinning much shorter than the gaps between arrivals is wasted
+  auto window = arrival_gap < 4 * busy_poll
+                    ? std::min(busy_poll, 2 * arrival_gap)
+                    : std::chrono::nanoseconds::zero();
+  if (timeout)
+    window = std::min(window, *timeout);
+
+  auto start = std::chrono::steady_clock::now();
+  int ret = 0;
+  while (std::chrono::steady_clock::now() - start < window) {
+    ret = wait(false);
+    if (ret == -1 || arrived())
+      break;
+  }
+
+  if (ret != -1 && !arrived())
+    ret = wait(true);
+
+  // deadlines tell nothing about the arrival rate
+  if (arrived()) {
+    auto gap = std::chrono::steady_clock::now() - start;
+    arrival_gap += (gap - arrival_gap) / 8;
+  }
+
+  return ret;
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+bool basic_io_engine<Backend, TimerQueue, Stats>::arrived() const {
+  return !ready.empty() || posted.load(std::memory_order_relaxed);
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+void basic_io_engine<Backend, TimerQueue, Stats>::run_ready() {
+  // coroutines woken by the resumed ones (through a channel, a mutex...) run
+  // in the same pull while the budget lasts, without a budget only what was
+  // queued before this run (so that they cannot keep the pull from ending)
+  std::size_t count = resume_budget;
+  if (!count)
+    for (auto &queue : run_queues)
+      count += queue.size();
+
+  std::size_t ran = 0;
+  for (; ran < count && runnable(); ++ran) {
+    // the turn of a class ends once its weight is spent or its queue is
+    // empty, it carries over to the next pull
+    while (turn_left == 0 || run_queues[turn].empty()) {
+      turn = (turn + 1) % priority_count;
+      turn_left = std::max<std::size_t>(priority_weights[turn], 1);
+    }
+    --turn_left;
+
+    running_lane = static_cast<priority>(turn);
+    inline_left = inline_budget;
+    auto resuming = stats.now();
+    run(run_queues[turn].pop_front());
+    stats.resumed(resuming);
+  }
+  stats.ran(ran);
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+void basic_io_engine<Backend, TimerQueue, Stats>::run(
+    std::coroutine_handle<> handle) {
+  if constexpr (!tracing_enabled) {
+    handle.resume();
+  } else {
+    // the frame may be gone once it returns, only its address is recorded
+    const void *coroutine = handle.address();
+    auto start = detail::trace_clock();
+    handle.resume();
+    detail::trace_buffer::local().record(trace_kind::resume, start,
+                                         detail::trace_clock() - start,
+                                         coroutine, -1, nullptr, std::nullopt);
+  }
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+void basic_io_engine<Backend, TimerQueue, Stats>::trace_suspend(
+    operation *op) {
+  if constexpr (tracing_enabled) {
+    if (!op->handle)
+      return;
+
+    op->trace.since = detail::trace_clock();
+    std::optional<std::uint64_t> deadline;
+    if (op->timeout != std::chrono::steady_clock::time_point::max())
+      deadline = static_cast<std::uint64_t>(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(
+              op->timeout.time_since_epoch())
+              .count());
+    detail::trace_buffer::local().record(trace_kind::suspend, op->trace.since,
+                                         0, op->handle.address(), op->fd,
+                                         trace_name(*op), deadline);
+  }
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+auto basic_io_engine<Backend, TimerQueue, Stats>::suspended() const
+    -> std::vector<suspended_coroutine> {
+  std::vector<suspended_coroutine> coroutines;
+  auto add = [&](const operation *op) {
+    // the wakeup and parked streams
+    if (!op->handle)
+      return;
+
+    auto &c = coroutines.emplace_back();
+    c.operation = trace_name(*op);
+    c.fd = op->fd;
+    if (op->timeout != std::chrono::steady_clock::time_point::max())
+      c.deadline = op->timeout;
+    c.stack.push_back(op->handle.address());
+
+    if constexpr (tracing_enabled) {
+      c.waiting = std::chrono::nanoseconds(detail::trace_clock() -
+                                           op->trace.since);
+      for (auto *frame = op->trace.frame ? op->trace.frame->caller : nullptr;
+           frame; frame = frame->caller)
+        if (frame->coroutine)
+          c.stack.push_back(frame->coroutine);
+    }
+  };
+
+  for (auto *op : operations)
+    add(op);
+  // timers without an fd are not in operations
+  for (auto *op : timers)
+    if (op->fd == -1 && op->code == op_code::poll)
+      add(op);
+
+  return coroutines;
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+void basic_io_engine<Backend, TimerQueue, Stats>::post(
+    std::coroutine_handle<> handle) {
+  stats.posted();
+  post(new posted_node{handle, nullptr, true});
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+void basic_io_engine<Backend, TimerQueue, Stats>::post(posted_node *node) {
+  posted_node *head = posted.load(std::memory_order_relaxed);
+  do {
+    node->next = head;
+  } while (!posted.compare_exchange_weak(head, node, std::memory_order_release,
+                                         std::memory_order_relaxed));
+
+  // the engine notices the rest while draining the list
+  if (!head)
+    wake();
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+void basic_io_engine<Backend, TimerQueue, Stats>::wake() {
+  std::uint64_t value = 1;
+  [[maybe_unused]] auto n =
+      ::write(static_cast<int>(wake_fd), &value, sizeof(value));
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+void basic_io_engine<Backend, TimerQueue, Stats>::take_posted() {
+  posted_node *list = posted.exchange(nullptr, std::memory_order_acquire);
+
+  // the stack is LIFO, resume in the order of posting
+  posted_node *fifo = nullptr;
+  while (list) {
+    posted_node *next = list->next;
+    list->next = fifo;
+    fifo = list;
+    list = next;
+  }
+
+  while (fifo) {
+    posted_node *node = fifo;
+    fifo = node->next;
+
+    if (node->cancelled) {
+      cancel_operation(node->cancelled);
+      continue;
+    }
+
+    resume_later(node->handle, node->lane);
+    if (node->owned)
+      delete node;
+  }
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+void basic_io_engine<Backend, TimerQueue, Stats>::arm_wakeup() {
+  // not awaited by any coroutine, do_pull handles it by itself
+  wake_op = operation{nullptr, static_cast<int>(wake_fd), POLLIN,
+                      std::chrono::steady_clock::time_point::max()};
+  add_operation(&wake_op);
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+void basic_io_engine<Backend, TimerQueue, Stats>::cancel_operation(
+    operation *op) {
+  // finished meanwhile, it only waited for this
+  if (op->stop->state.exchange(cancel_state::done,
+                               std::memory_order_acq_rel) ==
+      cancel_state::done) {
+    --deferred;
+    resume_later(op->handle, op->lane);
+    return;
+  }
+
+  // io that is done is reported as such
+  if (op->completed && op->code != op_code::poll)
+    return;
+
+  // the kernel may still use the buffer, the completion of the cancelled
+  // submission resumes the operation
+  if (op->user_data && op->code != op_code::poll) {
+    submit_cancel(op->user_data);
+    return;
+  }
+
+  if (op->queued) {
+    std::erase(ready, op);
+    op->queued = false;
+  }
+
+  detach(op);
+  op->error = std::make_error_code(std::errc::operation_canceled);
+  stats.finished(detail::operation_outcome::cancelled);
+  resume_later(op->handle, op->lane);
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+bool basic_io_engine<Backend, TimerQueue, Stats>::empty() const {
+  return operations.size() == 1 + parked && timers.empty() &&
+         !runnable() && end_queue.empty() &&
+         !deferred && !posted.load(std::memory_order_acquire);
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+void basic_io_engine<Backend, TimerQueue, Stats>::make_ready(operation *op) {
+  if (std::exchange(op->queued, true))
+    return;
+
+  ready.push_back(op);
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+void basic_io_engine<Backend, TimerQueue, Stats>::remove_operation(
+    operation *op) {
+  std::size_t index = op->index;
+  assert(operations[index] == op);
+
+  operations[index] = operations.back();
+  operations[index]->index = index;
+  operations.pop_back();
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+bool basic_io_engine<Backend, TimerQueue, Stats>::finish(
+    operation *op, std::chrono::steady_clock::time_point now,
+    std::error_code error) {
+  if (op->error || (op->completed && op->code != op_code::poll))
+    return true;
+
+  if (op->fd == -1)
+    return now >= op->timeout;
+
+  if (error) {
+    op->error = error;
+    return true;
+  }
+
+  if (op->code == op_code::poll) {
+    if (op->revents & POLLERR)
+      op->error = io_errc::pollerr;
+    else if (op->revents & POLLHUP)
+      op->error = io_errc::pollhup;
+    else if (op->revents & POLLNVAL)
+      op->error = io_errc::pollnval;
+    else if (op->revents & op->events)
+      return true;
+    else
+      return op->completed || now >= op->timeout;
+
+    return true;
+  }
+
+  // fd is ready (or in error state which the syscall will report)
+  if (op->revents) {
+    op->result = perform(op);
+    if (op->result != -EAGAIN && op->result != -EWOULDBLOCK)
+      return true;
+
+    // spurious readiness, keep waiting
+    op->revents = 0;
+    if (backend_kind() == backend::io_uring && !submit(op))
+      return true;
+  }
+
+  return now >= op->timeout;
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+void basic_io_engine<Backend, TimerQueue, Stats>::detach(operation *op) {
+  timers.erase(op);
+
+  // pure timers are not tracked in operations
+  if (op->fd == -1 && op->code == op_code::poll)
+    return;
+
+  remove_operation(op);
+
+  if (backend_kind() != backend::io_uring) {
+    unregister_waiter(op);
+  } else {
+    if (op->user_data)
+      cancel(op);
+  }
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+int basic_io_engine<Backend, TimerQueue, Stats>::wait_poll(bool block) {
+  std::span<pollfd> fds = pollfds;
+
+  int ret;
+  while (true) {
+    auto timeout = block ? wait_timeout() : std::chrono::nanoseconds::zero();
+    timespec ts =
+        detail::to_timespec(timeout.value_or(std::chrono::nanoseconds{}));
+    ret = ::ppoll(fds.data(), fds.size(), timeout ? &ts : nullptr, nullptr);
+
+    if (ret == -1) {
+      if (errno == EINTR)
+        continue;
+
+      break;
+    }
+
+    if (ret > 0 || timeout)
+      break;
+  }
+
+  for (std::size_t i = 0, left = ret > 0 ? ret : 0; left > 0; ++i) {
+    if (!fds[i].revents)
+      continue;
+
+    dispatch(registrations[polled_fds[i]], fds[i].revents);
+    --left;
+  }
+
+  return ret;
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+int basic_io_engine<Backend, TimerQueue, Stats>::wait_epoll(bool block) {
+  int efd = static_cast<int>(epfd);
+  int max_events = static_cast<int>(epoll_events.size());
+
+  int ret;
+  while (true) {
+    auto timeout = block ? wait_timeout() : std::chrono::nanoseconds::zero();
+
+    if (epoll_pwait2_supported) {
+      timespec ts =
+        detail::to_timespec(timeout.value_or(std::chrono::nanoseconds{}));
+      ret = ::epoll_pwait2(efd, epoll_events.data(), max_events,
+                           timeout ? &ts : nullptr, nullptr);
+
+      if (ret == -1 && errno == ENOSYS) {
+        epoll_pwait2_supported = false;
+        continue;
+      }
+    } else {
+      // round up, so that we do not wake up before the deadline
+      int ms = -1;
+      if (timeout)
+        ms = static_cast<int>(std::min<long long>(
+            std::chrono::ceil<std::chrono::milliseconds>(*timeout).count(),
+            INT_MAX));
+      ret = ::epoll_wait(efd, epoll_events.data(), max_events, ms);
+    }
+
+    if (ret == -1) {
+      if (errno == EINTR)
+        continue;
+
+      return ret;
+    }
+
+    if (ret > 0 || timeout)
+      break;
+  }
+
+  for (int i = 0; i < ret; ++i) {
+    int fd = epoll_events[i].data.fd;
+    auto revents = static_cast<short>(epoll_events[i].events);
+
+    auto *reg = find_registration(fd);
+    if (!reg)
+      continue;
+
+    dispatch(*reg, revents);
+    fired.push_back(fd);
+  }
+
+  // the buffer was filled up, there may be more events pending
+  if (static_cast<std::size_t>(ret) == epoll_events.size())
+    epoll_events.resize(epoll_events.size() * 2);
+
+  return ret;
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+int basic_io_engine<Backend, TimerQueue, Stats>::wait_uring(bool block) {
+  resubmit_cancels();
+
+  auto timeout = block ? wait_timeout() : std::chrono::nanoseconds::zero();
+
+  int ret = 0;
+  if (!timeout) {
+    ret = ring->enter(1);
+  } else if (*timeout == std::chrono::nanoseconds::zero()) {
+    // nothing to submit, completions can be reaped without a syscall
+    if (ring->pending())
+      ret = ring->enter(0);
+  } else {
+    timespec ts = detail::to_timespec(*timeout);
+    ret = ring->enter(1, &ts);
+  }
+
+  reap();
+
+  // the completion queue is full (its entries were reaped above), other
+  // failures are reported to the waiters as with the readiness backends
+  if (ret < 0 && ret != -ETIME && ret != -EBUSY) {
+    errno = -ret;
+    return -1;
+  }
+
+  return 0;
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+void basic_io_engine<Backend, TimerQueue, Stats>::reap() {
+  ring->for_each_cqe([&](const io_uring_cqe &cqe) {
+    // multishot submissions stay in flight while more completions follow
+    bool more = cqe.flags & IORING_CQE_F_MORE;
+    operation *op =
+        more ? slot_operation(cqe.user_data) : release_slot(cqe.user_data);
+
+    int buffer_id = -1;
+    if (cqe.flags & IORING_CQE_F_BUFFER)
+      buffer_id = static_cast<int>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+
+    // buffers picked for abandoned (or empty) reads go back to the pool
+    if (buffer_id >= 0 && (!op || cqe.res <= 0)) {
+      release_buffer(static_cast<std::uint16_t>(buffer_id));
+      buffer_id = -1;
+    }
+
+    if (!op)
+      return;
+
+    if (op->multishot) {
+      if (cqe.res >= 0)
+        op->revents |= static_cast<short>(cqe.res);
+      else if (cqe.res == -EBADF)
+        op->revents |= POLLNVAL;
+      else if (cqe.res != -ECANCELED)
+        op->error = std::error_code(-cqe.res, std::system_category());
+
+      // the kernel ended it (e.g. the completion queue overflowed), re-arm
+      if (!more) {
+        op->user_data = 0;
+        // a failure is delivered with the events
+        if (cqe.res >= 0)
+          submit(op);
+      }
+
+      make_ready(op);
+      return;
+    }
+
+    op->user_data = 0;
+
+    if (op->code == op_code::read_pooled && buffers.ring && !op->revents &&
+        cqe.res > 0) {
+      // readable now, let the kernel pick a buffer
+      op->revents = static_cast<short>(cqe.res);
+      if (!submit(op))
+        make_ready(op);
+      return;
+    }
+
+    make_ready(op);
+
+    // this was a poll, finish performs the io (errors are reported by the
+    // syscall)
+    if (polled(op)) {
+      op->revents = cqe.res >= 0 ? static_cast<short>(cqe.res) : POLLERR;
+      return;
+    }
+
+    op->completed = true;
+    op->buffer_id = buffer_id;
+    if (op->code != op_code::poll)
+      op->result = cqe.res;
+    else if (cqe.res >= 0)
+      op->revents = static_cast<short>(cqe.res);
+    else if (cqe.res == -EBADF)
+      op->revents = POLLNVAL;
+    else
+      op->error = std::error_code(-cqe.res, std::system_category());
+  });
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+io_uring_sqe *basic_io_engine<Backend, TimerQueue, Stats>::get_sqe() {
+  io_uring_sqe *sqe;
+  while (!(sqe = ring->get_sqe())) {
+    // submission queue is full, flush it
+    int ret = ring->enter(0);
+    if (ret < 0 && ret != -EBUSY) {
+      errno = -ret;
+      return nullptr;
+    }
+  }
+
+  return sqe;
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+bool basic_io_engine<Backend, TimerQueue, Stats>::submit(operation *op) {
+  io_uring_sqe *sqe = get_sqe();
+  if (!sqe) {
+    op->error = std::error_code(errno, std::system_category());
+    return false;
+  }
+
+  sqe->fd = op->fd;
+
+  switch (op->code) {
+  case op_code::poll:
+  case op_code::sendfile:
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->poll32_events = static_cast<std::uint16_t>(op->events);
+    // streams are reported every time until cancelled
+    if (op->multishot)
+      sqe->len = IORING_POLL_ADD_MULTI;
+    break;
+  case op_code::read:
+  case op_code::write:
+    if (fixed_buffer(op->buffer, op->length)) {
+      // the pool is registered, the kernel does not have to map its pages
+      sqe->opcode = op->code == op_code::read ? IORING_OP_READ_FIXED
+                                              : IORING_OP_WRITE_FIXED;
+      sqe->buf_index = 0;
+    } else {
+      sqe->opcode =
+          op->code == op_code::read ? IORING_OP_READ : IORING_OP_WRITE;
+    }
+    sqe->addr = reinterpret_cast<std::uint64_t>(op->buffer);
+    sqe->len = static_cast<std::uint32_t>(op->length);
+    // -1 uses (and advances) the current file position
+    sqe->off = static_cast<std::uint64_t>(op->offset);
+    break;
+  case op_code::read_pooled:
+  case op_code::recv_pooled:
+    if (!buffers.ring) {
+      sqe->opcode = IORING_OP_POLL_ADD;
+      sqe->poll32_events = static_cast<std::uint16_t>(op->events);
+      break;
+    }
+
+    // the kernel picks a buffer of the ring when the request is issued
+    // (failing if none is left), so it waits for data first
+    if (op->code == op_code::read_pooled) {
+      if (!op->revents) {
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->poll32_events = static_cast<std::uint16_t>(op->events);
+        break;
+      }
+
+      sqe->opcode = IORING_OP_READ;
+      sqe->off = static_cast<std::uint64_t>(-1);
+    } else {
+      sqe->opcode = IORING_OP_RECV;
+      sqe->ioprio = IORING_RECVSEND_POLL_FIRST;
+      sqe->msg_flags = static_cast<std::uint32_t>(op->flags);
+    }
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->len = static_cast<std::uint32_t>(buffers.size);
+    break;
+  case op_code::readv:
+  case op_code::writev:
+    sqe->opcode =
+        op->code == op_code::readv ? IORING_OP_READV : IORING_OP_WRITEV;
+    sqe->addr = reinterpret_cast<std::uint64_t>(op->buffer);
+    sqe->len = static_cast<std::uint32_t>(op->length);
+    sqe->off = static_cast<std::uint64_t>(-1);
+    break;
+  case op_code::recv:
+  case op_code::send:
+    sqe->opcode = op->code == op_code::recv ? IORING_OP_RECV : IORING_OP_SEND;
+    sqe->addr = reinterpret_cast<std::uint64_t>(op->buffer);
+    sqe->len = static_cast<std::uint32_t>(op->length);
+    sqe->msg_flags = static_cast<std::uint32_t>(op->flags);
+    break;
+  case op_code::accept:
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->addr = reinterpret_cast<std::uint64_t>(op->buffer);
+    sqe->addr2 = reinterpret_cast<std::uint64_t>(op->addrlen);
+    sqe->accept_flags = static_cast<std::uint32_t>(op->flags);
+    break;
+  case op_code::connect:
+    sqe->opcode = IORING_OP_CONNECT;
+    sqe->addr = reinterpret_cast<std::uint64_t>(op->buffer);
+    sqe->off = op->length;
+    break;
+  }
+
+  sqe->user_data = op->user_data = acquire_slot(op);
+  return true;
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+void basic_io_engine<Backend, TimerQueue, Stats>::submit_cancel(
+    std::uint64_t user_data) {
+  io_uring_sqe *sqe = get_sqe();
+  if (!sqe) {
+    // the kernel may still use the buffers, tried again by the next wait
+    unsent_cancels.push_back(user_data);
+    return;
+  }
+
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->addr = user_data;
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+void basic_io_engine<Backend, TimerQueue, Stats>::resubmit_cancels() {
+  auto pending = std::exchange(unsent_cancels, {});
+  for (auto user_data : pending)
+    submit_cancel(user_data);
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+void basic_io_engine<Backend, TimerQueue, Stats>::cancel(operation *op) {
+  submit_cancel(op->user_data);
+
+  // the completion of the cancelled submission will be ignored
+  release_slot(op->user_data);
+  op->user_data = 0;
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+std::uint64_t basic_io_engine<Backend, TimerQueue, Stats>::acquire_slot(
+    operation *op) {
+  std::uint32_t index;
+  if (free_slots.empty()) {
+    index = static_cast<std::uint32_t>(slots.size());
+    slots.emplace_back();
+  } else {
+    index = free_slots.back();
+    free_slots.pop_back();
+  }
+
+  slots[index].op = op;
+  return (std::uint64_t{slots[index].generation} << 32) | index;
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+auto basic_io_engine<Backend, TimerQueue, Stats>::slot_operation(
+    std::uint64_t user_data) const -> operation * {
+  auto index = static_cast<std::uint32_t>(user_data);
+  auto generation = static_cast<std::uint32_t>(user_data >> 32);
+
+  if (index >= slots.size() || slots[index].generation != generation)
+    return nullptr;
+
+  return slots[index].op;
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+auto
+basic_io_engine<Backend, TimerQueue, Stats>::release_slot(
+    std::uint64_t user_data) -> operation * {
+  auto index = static_cast<std::uint32_t>(user_data);
+  auto generation = static_cast<std::uint32_t>(user_data >> 32);
+
+  if (index >= slots.size() || slots[index].generation != generation ||
+      !slots[index].op)
+    return nullptr;
+
+  operation *op = std::exchange(slots[index].op, nullptr);
+  // generation 0 is never used, so user_data 0 never matches a slot
+  if (++slots[index].generation == 0)
+    slots[index].generation = 1;
+  free_slots.push_back(index);
+
+  return op;
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+void basic_io_engine<Backend, TimerQueue, Stats>::arm(int fd,
+                                                      registration &reg) {
+  reg.edge = std::ranges::all_of(reg.waiters,
+                                 [](operation *op) { return op->multishot; });
+
+  epoll_event ev{};
+  ev.events = reg.edge ? EPOLLET : EPOLLONESHOT;
+  ev.data.fd = fd;
+  for (auto *op : reg.waiters)
+    ev.events |= static_cast<std::uint16_t>(op->events);
+
+  int efd = static_cast<int>(epfd);
+  int ret;
+  if (reg.registered) {
+    ret = ::epoll_ctl(efd, EPOLL_CTL_MOD, fd, &ev);
+    // the fd was closed (and possibly reused) since it was last armed
+    if (ret == -1 && errno == ENOENT)
+      ret = ::epoll_ctl(efd, EPOLL_CTL_ADD, fd, &ev);
+  } else {
+    ret = ::epoll_ctl(efd, EPOLL_CTL_ADD, fd, &ev);
+    if (ret == -1 && errno == EEXIST)
+      ret = ::epoll_ctl(efd, EPOLL_CTL_MOD, fd, &ev);
+  }
+
+  if (ret == 0) {
+    reg.registered = true;
+    return;
+  }
+
+  reg.registered = false;
+
+  // mirror what poll would report for fds that cannot be waited on
+  std::error_code error;
+  short revents = 0;
+  if (errno == EPERM)
+    // regular files and directories are always ready
+    revents = POLLIN | POLLOUT;
+  else if (errno == EBADF)
+    revents = POLLNVAL;
+  else
+    error = std::error_code(errno, std::system_category());
+
+  for (auto *op : reg.waiters) {
+    op->revents |= revents & (op->events | POLLNVAL);
+    if (error)
+      op->error = error;
+    make_ready(op);
+  }
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+auto basic_io_engine<Backend, TimerQueue, Stats>::find_registration(int fd)
+    -> registration * {
+  if (fd < 0 || static_cast<std::size_t>(fd) >= registrations.size())
+    return nullptr;
+
+  return &registrations[fd];
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+void basic_io_engine<Backend, TimerQueue, Stats>::register_waiter(
+    operation *op) {
+  // fds are small and dense, the table grows up to the highest one waited on
+  // (entries of closed fds are reused when the number is handed out again)
+  if (static_cast<std::size_t>(op->fd) >= registrations.size())
+    registrations.resize(
+        std::max<std::size_t>(64, std::bit_ceil(op->fd + 1u)));
+
+  auto &reg = registrations[op->fd];
+  reg.waiters.push_back(op);
+
+  if (backend_kind() == backend::epoll)
+    arm(op->fd, reg);
+  else
+    update_pollfd(op->fd, reg);
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+void basic_io_engine<Backend, TimerQueue, Stats>::unregister_waiter(
+    operation *op) {
+  auto *reg = find_registration(op->fd);
+  if (!reg)
+    return;
+
+  std::erase(reg->waiters, op);
+  // epoll re-arms with the events of those left when the fd is reported
+  if (backend_kind() == backend::poll)
+    update_pollfd(op->fd, *reg);
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+void basic_io_engine<Backend, TimerQueue, Stats>::update_pollfd(
+    int fd, registration &reg) {
+  if (reg.waiters.empty()) {
+    if (reg.slot == registration::npos)
+      return;
+
+    // swap-remove
+    std::size_t slot = std::exchange(reg.slot, registration::npos);
+    pollfds[slot] = pollfds.back();
+    polled_fds[slot] = polled_fds.back();
+    pollfds.pop_back();
+    polled_fds.pop_back();
+    if (slot < pollfds.size())
+      registrations[polled_fds[slot]].slot = slot;
+    return;
+  }
+
+  if (reg.slot == registration::npos) {
+    reg.slot = pollfds.size();
+    pollfds.push_back(pollfd{fd, 0, 0});
+    polled_fds.push_back(fd);
+  }
+
+  // poll is level-triggered, parked streams would have the fd reported over
+  // and over
+  short events = 0;
+  bool active = false;
+  for (auto *op : reg.waiters)
+    if (!op->multishot || op->handle) {
+      events |= op->events;
+      active = true;
+    }
+
+  pollfds[reg.slot].fd = active ? fd : -1;
+  pollfds[reg.slot].events = events;
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+void basic_io_engine<Backend, TimerQueue, Stats>::dispatch(registration &reg,
+                                                           short revents) {
+  for (auto *op : reg.waiters) {
+    op->revents |= revents & (op->events | POLLERR | POLLHUP | POLLNVAL);
+    if (op->revents)
+      make_ready(op);
+  }
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+auto
+basic_io_engine<Backend, TimerQueue, Stats>::current() -> basic_io_engine * {
+  if (running)
+    return running;
+  // pool workers run io_engines
+  if constexpr (std::is_same_v<basic_io_engine, io_engine>)
+    return io_engine_pool::current_engine();
+  else
+    return nullptr;
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+void basic_io_engine<Backend, TimerQueue, Stats>::pull() {
+  do_pull(false);
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+void basic_io_engine<Backend, TimerQueue, Stats>::pull_wait() {
+  do_pull(true);
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+void basic_io_engine<Backend, TimerQueue, Stats>::pull_all() {
+  while (!empty())
+    do_pull(true);
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+bool basic_io_engine<Backend, TimerQueue, Stats>::polled(
+    const operation *op) const {
+  return op->code == op_code::sendfile ||
+         ((op->code == op_code::read_pooled ||
+           op->code == op_code::recv_pooled) &&
+          !buffers.ring);
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+bool basic_io_engine<Backend, TimerQueue, Stats>::try_complete(operation *op) {
+  // io_uring attempts the io by itself
+  if (backend_kind() == backend::io_uring && !polled(op))
+    return false;
+
+  if (op->code == op_code::connect) {
+    // the connection has to be started anyway, its outcome is fetched by
+    // perform once the fd is writable
+    if (::connect(op->fd, static_cast<sockaddr *>(op->buffer),
+                  static_cast<socklen_t>(op->length)) == 0)
+      op->result = 0;
+    else if (errno != EINPROGRESS)
+      op->result = -errno;
+    else
+      return false;
+
+    return true;
+  }
+
+  if (inline_left == 0)
+    return false;
+
+  op->result = perform(op);
+  if (op->result == -EAGAIN || op->result == -EWOULDBLOCK)
+    return false;
+
+  --inline_left;
+  return true;
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+void basic_io_engine<Backend, TimerQueue, Stats>::add_operation(operation *op) {
+  assert(op->handle || op == &wake_op || op->multishot);
+
+  if (op->timeout != std::chrono::steady_clock::time_point::max()) {
+    op->timeout = round_deadline(op->timeout, timer_slack);
+    timers.push(op);
+  }
+  trace_suspend(op);
+
+  // only timers come without an fd
+  if (op->fd == -1 && op->code == op_code::poll)
+    return;
+
+  op->index = operations.size();
+  operations.push_back(op);
+
+  if (op->fd < 0) {
+    op->result = -EBADF;
+    op->completed = true;
+    make_ready(op);
+    return;
+  }
+
+  if (backend_kind() == backend::io_uring) {
+    if (!submit(op))
+      make_ready(op);
+    return;
+  }
+
+  register_waiter(op);
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+void basic_io_engine<Backend, TimerQueue, Stats>::add_stream(operation *op) {
+  op->multishot = true;
+  add_operation(op);
+  park(op);
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+void basic_io_engine<Backend, TimerQueue, Stats>::park(operation *op) {
+  op->handle = nullptr;
+  ++parked;
+
+  if (backend_kind() == backend::poll)
+    update_pollfd(op->fd, registrations[op->fd]);
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+void basic_io_engine<Backend, TimerQueue, Stats>::unpark(
+    operation *op, std::coroutine_handle<> handle) {
+  assert(op->multishot && !op->handle);
+  op->handle = handle;
+  --parked;
+  trace_suspend(op);
+
+  if (backend_kind() == backend::poll)
+    update_pollfd(op->fd, registrations[op->fd]);
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+void basic_io_engine<Backend, TimerQueue, Stats>::drop_stream(operation *op) {
+  if (op->queued) {
+    std::erase(ready, op);
+    op->queued = false;
+  }
+
+  if (!op->handle)
+    --parked;
+  detach(op);
+  op->multishot = false;
+
+  // edge-triggered fds stay armed, stop their reports if nobody is left
+  if (backend_kind() == backend::epoll) {
+    auto *reg = find_registration(op->fd);
+    if (reg && reg->waiters.empty() && reg->registered) {
+      ::epoll_ctl(static_cast<int>(epfd), EPOLL_CTL_DEL, op->fd, nullptr);
+      reg->registered = false;
+    }
+  }
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+void basic_io_engine<Backend, TimerQueue, Stats>::deliver(
+    operation *op, std::error_code error) {
+  if (error)
+    op->error = error;
+  else if (op->revents & POLLERR)
+    op->error = io_errc::pollerr;
+  else if (op->revents & POLLHUP)
+    op->error = io_errc::pollhup;
+  else if (op->revents & POLLNVAL)
+    op->error = io_errc::pollnval;
+  else if (!(op->revents & op->events))
+    return;
+
+  // kept until the next await otherwise
+  if (!op->handle)
+    return;
+
+  stats.finished(detail::operation_outcome::ready);
+  resume_later(op->handle, op->lane);
+  park(op);
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+void basic_io_engine<Backend, TimerQueue, Stats>::setup_buffers(
+    std::size_t count, std::size_t size) {
+  if (count > 32768 || size == 0 || size > INT32_MAX)
+    throw std::invalid_argument("io_engine buffer pool");
+
+  // pages are only backed once buffers are used
+  buffers.mapped = count * size;
+  void *base = ::mmap(nullptr, buffers.mapped, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base == MAP_FAILED)
+    utils::throw_sys_error("mmap");
+
+  buffers.base = static_cast<std::byte *>(base);
+  buffers.size = size;
+
+  if (ring) {
+    // registering may fail (e.g. locked memory limit), io still works
+    iovec iov{base, buffers.mapped};
+    buffers.fixed =
+        ring->register_resource(IORING_REGISTER_BUFFERS, &iov, 1) == 0;
+
+    // provided buffer rings need linux 5.19, pooled reads poll first
+    // without them
+    std::size_t entries = std::bit_ceil(count);
+    buffers.ring_mapped = entries * sizeof(io_uring_buf);
+    void *ring_base = ::mmap(nullptr, buffers.ring_mapped,
+                             PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring_base != MAP_FAILED) {
+      io_uring_buf_reg reg{};
+      reg.ring_addr = reinterpret_cast<std::uint64_t>(ring_base);
+      reg.ring_entries = static_cast<std::uint32_t>(entries);
+      reg.bgid = 0;
+
+      if (ring->register_resource(IORING_REGISTER_PBUF_RING, &reg, 1) == 0) {
+        buffers.ring = static_cast<io_uring_buf_ring *>(ring_base);
+        buffers.ring_mask = static_cast<std::uint16_t>(entries - 1);
+      } else {
+        ::munmap(ring_base, buffers.ring_mapped);
+      }
+    }
+  }
+
+  if (!buffers.ring)
+    buffers.free.reserve(count);
+  for (std::size_t i = count; i-- > 0;)
+    release_buffer(static_cast<std::uint16_t>(i));
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+void basic_io_engine<Backend, TimerQueue, Stats>::release_buffer(
+    std::uint16_t id) {
+  if (!buffers.ring) {
+    buffers.free.push_back(id);
+    return;
+  }
+
+  // the tail overlays the first entry, so only the fields are written (bufs
+  // cannot be used, its flexible array wrapper is not empty in c++)
+  auto &entry = reinterpret_cast<io_uring_buf *>(
+      buffers.ring)[buffers.ring_tail & buffers.ring_mask];
+  entry.addr = reinterpret_cast<std::uint64_t>(buffers.base + id * buffers.size);
+  entry.len = static_cast<std::uint32_t>(buffers.size);
+  entry.bid = id;
+
+  ++buffers.ring_tail;
+  std::atomic_ref(buffers.ring->tail)
+      .store(buffers.ring_tail, std::memory_order_release);
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+bool basic_io_engine<Backend, TimerQueue, Stats>::fixed_buffer(
+    const void *buffer, std::size_t length) const {
+  auto *begin = static_cast<const std::byte *>(buffer);
+  return buffers.fixed && begin >= buffers.base &&
+         begin + length <= buffers.base + buffers.mapped;
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+void basic_io_engine<Backend, TimerQueue, Stats>::write_coalescer::push(
+    entry *e) {
+  if (tail)
+    tail->next = e;
+  else
+    head = e;
+  tail = e;
+
+  // the previous flusher is done (it only stops once the queue is empty)
+  if (!std::exchange(flushing, true))
+    flusher.emplace(drain());
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+eager_task<void>
+basic_io_engine<Backend, TimerQueue, Stats>::write_coalescer::drain() {
+  // let the other coroutines of this pull queue their writes
+  co_await engine.defer();
+
+  while (head) {
+    if (flush())
+      continue;
+
+    auto ready = co_await engine.poll(fd, POLLOUT, std::nothrow);
+    if (!ready)
+      fail(ready.error());
+  }
+
+  flushing = false;
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+bool basic_io_engine<Backend, TimerQueue, Stats>::write_coalescer::flush() {
+  std::array<iovec, 64> iov;
+  int count = 0;
+  for (entry *e = head; e && count < static_cast<int>(iov.size());
+       e = e->next)
+    iov[count++] = {const_cast<std::byte *>(e->data.data() + e->written),
+                    e->data.size() - e->written};
+
+  ssize_t ret = -1;
+  if (!plain) {
+    msghdr msg{};
+    msg.msg_iov = iov.data();
+    msg.msg_iovlen = static_cast<std::size_t>(count);
+    ret = ::sendmsg(static_cast<int>(fd), &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (ret == -1 && errno == ENOTSOCK)
+      plain = true;
+  }
+  if (plain)
+    ret = ::writev(static_cast<int>(fd), iov.data(), count);
+
+  if (ret == -1) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+      return false;
+    if (errno != EINTR)
+      fail(std::error_code(errno, std::system_category()));
+    return true;
+  }
+
+  // resume the writes that are done
+  auto left = static_cast<std::size_t>(ret);
+  while (head) {
+    std::size_t step = std::min(head->data.size() - head->written, left);
+    head->written += step;
+    left -= step;
+    if (head->written < head->data.size())
+      break;
+
+    entry *e = std::exchange(head, head->next);
+    engine.resume_later(e->handle, e->lane);
+  }
+  if (!head)
+    tail = nullptr;
+
+  return true;
+}
+
+template <typename Backend, template <typename> class TimerQueue,
+          typename Stats>
+void basic_io_engine<Backend, TimerQueue, Stats>::write_coalescer::fail(
+    std::error_code error) {
+  while (head) {
+    entry *e = std::exchange(head, head->next);
+    e->error = error;
+    engine.resume_later(e->handle, e->lane);
+  }
+  tail = nullptr;
+}
+
+} // namespace coro
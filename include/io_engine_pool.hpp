@@ -0,0 +1,93 @@
+#pragma once
+
+#include "io_engine.hpp"
+
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace coro {
+
+/*
+pool of worker threads, each one owning an io_engine and running coroutines
+scheduled onto it
+
+every worker has a lock-free local queue, idle workers steal from the others
+(coroutines scheduled from outside of the pool go through a shared queue)
+*/
+class io_engine_pool {
+public:
+  struct options {
+    // 0 means std::thread::hardware_concurrency()
+    std::size_t threads = 0;
+    // pin worker i to cpu i (modulo the number of cpus)
+    bool pin = false;
+    // configuration of every worker's engine
+    io_engine::options engine;
+  };
+
+  io_engine_pool() : io_engine_pool(options{}) {}
+  explicit io_engine_pool(options opts);
+  io_engine_pool(const io_engine_pool &) = delete;
+  io_engine_pool &operator=(const io_engine_pool &) = delete;
+  io_engine_pool(io_engine_pool &&) = delete;
+  io_engine_pool &operator=(io_engine_pool &&) = delete;
+
+  // stops the workers (coroutines still queued are never resumed)
+  ~io_engine_pool();
+
+  // resume the awaiting coroutine on one of the workers
+  auto schedule() {
+    struct awaiter {
+      io_engine_pool &pool;
+
+      bool await_ready() const { return false; }
+      void await_suspend(std::coroutine_handle<> handle) {
+        pool.submit(handle);
+      }
+      void await_resume() {}
+    };
+
+    return awaiter{*this};
+  }
+
+  // thread-safe, handle will be resumed on one of the workers
+  void submit(std::coroutine_handle<> handle);
+
+  std::size_t size() const { return workers.size(); }
+  io_engine &engine(std::size_t worker);
+
+  // engine of the worker running the calling thread (nullptr outside of any
+  // pool)
+  static io_engine *current_engine();
+
+  // ask all workers to exit and wait for them
+  void stop();
+
+private:
+  struct worker;
+
+  void run(worker &w);
+  std::coroutine_handle<> next(worker &w);
+  bool has_work(const worker &w) const;
+  void notify();
+
+  // worker running on the calling thread
+  static thread_local worker *current;
+
+  std::vector<std::unique_ptr<worker>> workers;
+
+  std::mutex injected_mutex;
+  std::deque<std::coroutine_handle<>> injected;
+  std::atomic<std::size_t> injected_size = 0;
+
+  std::atomic<std::size_t> idle = 0;
+  std::atomic<bool> stopping = false;
+};
+
+} // namespace coro
@@ -0,0 +1,254 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+namespace coro {
+
+// the engine records metrics only if built with CORO_ASYNCIO_METRICS
+#ifdef CORO_ASYNCIO_METRICS
+inline constexpr bool metrics_enabled = true;
+#else
+inline constexpr bool metrics_enabled = false;
+#endif
+
+/*
+log-linear histogram of 64-bit values: every power of two is split into 8
+linear buckets, so a bucket is at most 12.5% wide relative to its values
+
+it is recorded by a single thread and can be read by any other one
+*/
+class histogram {
+public:
+  static constexpr unsigned sub_bits = 3;
+  static constexpr std::size_t sub_count = std::size_t{1} << sub_bits;
+  static constexpr std::size_t bucket_count = (64 - sub_bits + 1) * sub_count;
+
+  static constexpr std::size_t bucket(std::uint64_t value) {
+    if (value < sub_count)
+      return static_cast<std::size_t>(value);
+
+    unsigned shift = static_cast<unsigned>(std::bit_width(value)) - sub_bits - 1;
+    return ((shift + 1) << sub_bits) +
+           static_cast<std::size_t>((value >> shift) & (sub_count - 1));
+  }
+
+  // smallest value of the bucket
+  static constexpr std::uint64_t lower_bound(std::size_t index) {
+    if (index < sub_count)
+      return index;
+
+    unsigned shift = static_cast<unsigned>(index >> sub_bits) - 1;
+    return (sub_count + (index & (sub_count - 1))) << shift;
+  }
+
+  // largest value of the bucket
+  static constexpr std::uint64_t upper_bound(std::size_t index) {
+    return index + 1 == bucket_count ? UINT64_MAX : lower_bound(index + 1) - 1;
+  }
+
+  struct snapshot {
+    std::array<std::uint64_t, bucket_count> counts{};
+    std::uint64_t count = 0;
+    std::uint64_t sum = 0;
+    std::uint64_t max = 0;
+
+    double mean() const {
+      return count ? static_cast<double>(sum) / static_cast<double>(count) : 0;
+    }
+
+    // upper bound of the bucket holding the q-quantile (q in [0, 1]), within
+    // 12.5% of the actual value
+    std::uint64_t quantile(double q) const {
+      if (!count)
+        return 0;
+
+      auto rank = static_cast<std::uint64_t>(q * static_cast<double>(count));
+      rank = rank < count ? rank + 1 : count;
+
+      std::uint64_t seen = 0;
+      for (std::size_t i = 0; i < bucket_count; ++i) {
+        seen += counts[i];
+        if (seen >= rank)
+          return upper_bound(i) < max ? upper_bound(i) : max;
+      }
+      return max;
+    }
+  };
+
+  // only called by the recording thread, so plain loads and stores are
+  // enough (no locked instructions)
+  void record(std::uint64_t value) {
+    increment(buckets[bucket(value)], 1);
+    increment(total, 1);
+    increment(sum, value);
+    if (value > max.load(std::memory_order_relaxed))
+      max.store(value, std::memory_order_relaxed);
+  }
+
+  // consistent per bucket, buckets recorded meanwhile may be missing from the
+  // totals
+  snapshot read() const {
+    snapshot s;
+    for (std::size_t i = 0; i < bucket_count; ++i)
+      s.counts[i] = buckets[i].load(std::memory_order_relaxed);
+    s.count = total.load(std::memory_order_relaxed);
+    s.sum = sum.load(std::memory_order_relaxed);
+    s.max = max.load(std::memory_order_relaxed);
+    return s;
+  }
+
+  static void increment(std::atomic<std::uint64_t> &counter,
+                        std::uint64_t value) {
+    counter.store(counter.load(std::memory_order_relaxed) + value,
+                  std::memory_order_relaxed);
+  }
+
+private:
+  std::array<std::atomic<std::uint64_t>, bucket_count> buckets{};
+  std::atomic<std::uint64_t> total = 0;
+  std::atomic<std::uint64_t> sum = 0;
+  std::atomic<std::uint64_t> max = 0;
+};
+
+// what io_engine did so far (all zero unless metrics are enabled)
+struct io_engine_metrics {
+  // iterations of the event loop (pull, pull_wait, run...)
+  std::uint64_t pulls = 0;
+  // coroutines resumed by the loop and coroutines posted to it
+  std::uint64_t resumed = 0;
+  std::uint64_t posted = 0;
+
+  // how finished operations ended: fd ready or io done, deadline reached,
+  // error reported (including cancellations) and cancelled by a stop token
+  std::uint64_t ready = 0;
+  std::uint64_t timed_out = 0;
+  std::uint64_t failed = 0;
+  std::uint64_t cancelled = 0;
+  // plain timers (wait_for, wait_until)
+  std::uint64_t timers = 0;
+
+  // waiting operations and deadlines at the last pull
+  std::uint64_t operations = 0;
+  std::uint64_t deadlines = 0;
+
+  // nanoseconds between a deadline and the pull that noticed it (event loop
+  // stalls show up here)
+  histogram::snapshot loop_lag;
+  // nanoseconds spent in the backend's wait (including blocking)
+  histogram::snapshot poll_wait;
+  // nanoseconds a resumed coroutine ran until it suspended
+  histogram::snapshot resume;
+  // coroutines resumed per pull
+  histogram::snapshot batch;
+};
+
+namespace detail {
+
+// how an operation of the engine ended
+enum class operation_outcome { ready, timed_out, failed, cancelled, timer };
+
+// metrics of an engine, recorded by its thread
+class recorded_metrics {
+public:
+  using stamp = std::chrono::steady_clock::time_point;
+
+  using outcome = operation_outcome;
+
+  static stamp now() { return std::chrono::steady_clock::now(); }
+
+  void pulled(std::size_t operations, std::size_t deadlines) {
+    histogram::increment(pulls, 1);
+    this->operations.store(operations, std::memory_order_relaxed);
+    this->deadlines.store(deadlines, std::memory_order_relaxed);
+  }
+  void waited(stamp since) { poll_wait.record(elapsed(since)); }
+  void late(std::chrono::nanoseconds lag) {
+    loop_lag.record(static_cast<std::uint64_t>(lag.count()));
+  }
+  void finished(outcome what) {
+    histogram::increment(outcomes[static_cast<std::size_t>(what)], 1);
+  }
+  void resumed(stamp since) { resume.record(elapsed(since)); }
+  void ran(std::size_t count) {
+    histogram::increment(resumes, count);
+    batch.record(count);
+  }
+  // any thread
+  void posted() { posts.fetch_add(1, std::memory_order_relaxed); }
+
+  io_engine_metrics read() const {
+    io_engine_metrics m;
+    m.pulls = pulls.load(std::memory_order_relaxed);
+    m.resumed = resumes.load(std::memory_order_relaxed);
+    m.posted = posts.load(std::memory_order_relaxed);
+    m.ready = load(outcome::ready);
+    m.timed_out = load(outcome::timed_out);
+    m.failed = load(outcome::failed);
+    m.cancelled = load(outcome::cancelled);
+    m.timers = load(outcome::timer);
+    m.operations = operations.load(std::memory_order_relaxed);
+    m.deadlines = deadlines.load(std::memory_order_relaxed);
+    m.loop_lag = loop_lag.read();
+    m.poll_wait = poll_wait.read();
+    m.resume = resume.read();
+    m.batch = batch.read();
+    return m;
+  }
+
+private:
+  static std::uint64_t elapsed(stamp since) {
+    return static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(now() - since)
+            .count());
+  }
+  std::uint64_t load(outcome what) const {
+    return outcomes[static_cast<std::size_t>(what)].load(
+        std::memory_order_relaxed);
+  }
+
+  std::atomic<std::uint64_t> pulls = 0;
+  std::atomic<std::uint64_t> resumes = 0;
+  std::atomic<std::uint64_t> posts = 0;
+  std::array<std::atomic<std::uint64_t>, 5> outcomes{};
+  std::atomic<std::uint64_t> operations = 0;
+  std::atomic<std::uint64_t> deadlines = 0;
+
+  histogram loop_lag;
+  histogram poll_wait;
+  histogram resume;
+  histogram batch;
+};
+
+// compiled out, every call is a no-op
+class no_metrics {
+public:
+  struct stamp {};
+
+  using outcome = operation_outcome;
+
+  static stamp now() { return {}; }
+
+  void pulled(std::size_t, std::size_t) {}
+  void waited(stamp) {}
+  void late(std::chrono::nanoseconds) {}
+  void finished(outcome) {}
+  void resumed(stamp) {}
+  void ran(std::size_t) {}
+  void posted() {}
+
+  io_engine_metrics read() const { return {}; }
+};
+
+// those of io_engine
+using engine_metrics =
+    std::conditional_t<metrics_enabled, recorded_metrics, no_metrics>;
+
+} // namespace detail
+
+} // namespace coro
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+namespace coro::detail {
+
+// growable FIFO queue in a single power-of-two buffer (no allocations once it
+// reached its working size, unlike std::deque)
+template <typename T> class ring_buffer {
+public:
+  ring_buffer() = default;
+  ring_buffer(const ring_buffer &) = delete;
+  ring_buffer &operator=(const ring_buffer &) = delete;
+
+  bool empty() const { return head == tail; }
+  std::size_t size() const { return tail - head; }
+
+  void push_back(T value) {
+    if (size() == capacity)
+      grow();
+
+    buffer[tail++ & (capacity - 1)] = std::move(value);
+  }
+
+  T &front() {
+    assert(!empty());
+    return buffer[head & (capacity - 1)];
+  }
+
+  T pop_front() {
+    T value = std::move(front());
+    ++head;
+    return value;
+  }
+
+private:
+  void grow() {
+    std::size_t new_capacity = capacity ? capacity * 2 : 16;
+    auto new_buffer = std::make_unique<T[]>(new_capacity);
+
+    for (std::size_t i = 0; i < size(); ++i)
+      new_buffer[i] = std::move(buffer[(head + i) & (capacity - 1)]);
+
+    tail = size();
+    head = 0;
+    buffer = std::move(new_buffer);
+    capacity = new_capacity;
+  }
+
+  std::unique_ptr<T[]> buffer;
+  std::size_t capacity = 0;
+  std::size_t head = 0;
+  std::size_t tail = 0;
+};
+
+} // namespace coro::detail
@@ -0,0 +1,180 @@
+#pragma once
+
+#include "io_engine.hpp"
+
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+namespace coro {
+
+namespace detail {
+
+/*
+hands a suspended coroutine back to the engine it waited on: it is queued on
+the run queue of its priority when the calling thread pulls that engine (no
+syscall and no atomics, the running pull resumes it within its
+resume_budget), posted to it
+otherwise (through the node kept in the waiter, so nothing is allocated) and
+resumed right away if it did not wait on any engine
+*/
+struct sync_access {
+  struct waiter {
+    std::coroutine_handle<> handle;
+    io_engine *engine = nullptr;
+    waiter *next = nullptr;
+    io_engine::posted_node node;
+
+    // the waiter is the coroutine the engine is running, it is woken in its
+    // class
+    void suspend(std::coroutine_handle<> handle) {
+      this->handle = handle;
+      engine = io_engine::current();
+      if (engine)
+        node.lane = engine->running_lane;
+    }
+  };
+
+  // never call it while holding a lock, the waiter may be resumed inline
+  static void wake(waiter &w) {
+    if (!w.engine) {
+      w.handle.resume();
+    } else if (w.engine == io_engine::current()) {
+      w.engine->resume_later(w.handle, w.node.lane);
+    } else {
+      w.node.handle = w.handle;
+      w.engine->post(&w.node);
+    }
+  }
+};
+
+// intrusive FIFO of waiters (of type W derived from sync_access::waiter)
+template <typename W> class waiter_list {
+public:
+  bool empty() const { return head == nullptr; }
+  W *front() const { return static_cast<W *>(head); }
+
+  void push_back(W *w) {
+    w->next = nullptr;
+    if (tail)
+      tail->next = w;
+    else
+      head = w;
+    tail = w;
+  }
+
+  // nullptr when empty, the next pointer is read before the waiter is woken
+  W *pop_front() {
+    auto *w = static_cast<W *>(head);
+    if (w) {
+      head = w->next;
+      if (!head)
+        tail = nullptr;
+    }
+    return w;
+  }
+
+private:
+  sync_access::waiter *head = nullptr;
+  sync_access::waiter *tail = nullptr;
+};
+
+} // namespace detail
+
+/*
+mutex for coroutines, lock suspends the awaiting coroutine until the mutex is
+handed over to it (in FIFO order), unlock resumes the next waiter on its
+engine (see detail::sync_access)
+
+lock-free: the waiters are pushed onto an atomic stack, reversed into a queue
+by unlock (it must be unlocked when destroyed)
+*/
+class async_mutex {
+public:
+  async_mutex() = default;
+  async_mutex(const async_mutex &) = delete;
+  async_mutex &operator=(const async_mutex &) = delete;
+
+  bool try_lock();
+
+  auto lock() { return lock_awaiter{{}, *this}; }
+
+  // lock and get a guard that unlocks it when destroyed
+  auto scoped_lock() { return scoped_lock_awaiter{{{}, *this}}; }
+
+  void unlock();
+
+private:
+  using waiter = detail::sync_access::waiter;
+
+  struct lock_awaiter : waiter {
+    async_mutex &mutex;
+
+    bool await_ready() { return mutex.try_lock(); }
+    bool await_suspend(std::coroutine_handle<> handle);
+    void await_resume() {}
+  };
+
+  struct scoped_lock_awaiter : lock_awaiter {
+    std::unique_lock<async_mutex> await_resume() {
+      return std::unique_lock<async_mutex>(this->mutex, std::adopt_lock);
+    }
+  };
+
+  static constexpr std::uintptr_t locked_no_waiters = 0;
+  static constexpr std::uintptr_t not_locked = 1;
+
+  // not_locked, locked_no_waiters or the stack of waiters that arrived since
+  // the last unlock (most recent first)
+  std::atomic<std::uintptr_t> state = not_locked;
+  // waiters already taken from state (oldest first), owned by the holder
+  waiter *waiters = nullptr;
+};
+
+/*
+counting semaphore for coroutines, acquire suspends the awaiting coroutine
+until a permit released is handed over to it, release resumes the waiters on
+their engines (see detail::sync_access)
+
+permits are taken with atomics, the lock is only used by coroutines that have
+to wait and by release when someone waits (try_acquire may take a permit
+before older waiters)
+*/
+class async_semaphore {
+public:
+  explicit async_semaphore(std::size_t count) : count(count) {}
+  async_semaphore(const async_semaphore &) = delete;
+  async_semaphore &operator=(const async_semaphore &) = delete;
+
+  bool try_acquire();
+
+  auto acquire() { return acquire_awaiter{{}, *this}; }
+
+  void release(std::size_t permits = 1);
+
+  // permits not taken (changes concurrently)
+  std::size_t available() const {
+    return count.load(std::memory_order_relaxed);
+  }
+
+private:
+  using waiter = detail::sync_access::waiter;
+
+  struct acquire_awaiter : waiter {
+    async_semaphore &semaphore;
+
+    bool await_ready() { return semaphore.try_acquire(); }
+    bool await_suspend(std::coroutine_handle<> handle);
+    void await_resume() {}
+  };
+
+  std::atomic<std::size_t> count;
+  // coroutines registered as waiting (checked by release without the lock)
+  std::atomic<std::size_t> waiting = 0;
+  std::mutex mutex;
+  detail::waiter_list<waiter> waiters;
+};
+
+} // namespace coro
@@ -0,0 +1,177 @@
+#pragma once
+
+#include "combinators.hpp"
+#include "frame_allocator.hpp"
+#include "io_engine.hpp"
+
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <stop_token>
+#include <utility>
+
+namespace coro {
+
+/*
+scope of child coroutines: spawn starts them right away (on the engine the
+caller runs on, until they first suspend) and join awaits all of them, then
+rethrows the first exception one of them threw (which also asked the others
+to stop through the group's stop token)
+
+the frames of the children come from an arena of the group and are released
+all at once when join completes, the group can then be used again; spawn and
+join are called by the owner only, the children may complete on any thread
+(the last one resumes join's coroutine by symmetric transfer)
+*/
+class task_group {
+public:
+  // arena_size bytes are kept for the frames across joins, children needing
+  // more get blocks that are freed by join
+  explicit task_group(std::size_t arena_size = 4096);
+  task_group(const task_group &) = delete;
+  task_group &operator=(const task_group &) = delete;
+
+  // must be joined (no child may be running)
+  ~task_group();
+
+  /*
+  start fn(args...), a coroutine returning lazy_task or eager_task (its value
+  is discarded), lazy_tasks see the group's token through get_stop_token
+  from the start, eager ones once they are returned by fn
+  */
+  template <typename Fn, typename... Args>
+  void spawn(Fn &&fn, Args &&...args) {
+    auto task = [&] {
+      struct reset {
+        ~reset() { detail::frame_allocated::next_resource = nullptr; }
+      } guard;
+      detail::frame_allocated::next_resource = &arena;
+      return std::invoke(std::forward<Fn>(fn), std::forward<Args>(args)...);
+    }();
+    static_assert(detail::join_task<decltype(task)>,
+                  "task_group children are lazy_task or eager_task");
+
+    detail::join_access::inherit(task, source.get_token());
+    // counted before it starts (it may complete right away), run throws only
+    // if its frame cannot be allocated, before the child ran
+    remaining.fetch_add(1, std::memory_order_relaxed);
+    try {
+      run(std::allocator_arg, &arena, *this, std::move(task));
+    } catch (...) {
+      remaining.fetch_sub(1, std::memory_order_relaxed);
+      throw;
+    }
+  }
+
+  // await all the children spawned so far, stopping the awaiting coroutine
+  // stops them as well
+  auto join() { return join_awaiter{*this, std::nullopt}; }
+
+  // ask the children to stop (the engine's operations taking their token
+  // are cancelled)
+  void request_stop() noexcept { source.request_stop(); }
+  std::stop_token get_stop_token() const noexcept {
+    return source.get_token();
+  }
+
+private:
+  struct child {
+    struct promise_type : detail::frame_allocated {
+      // the task awaited got the group's token from spawn (the promise has
+      // none to pass on)
+      template <typename Task>
+      promise_type(std::allocator_arg_t, std::pmr::memory_resource *,
+                   task_group &group, Task &)
+          : group(group) {}
+
+      child get_return_object() { return {}; }
+      std::suspend_never initial_suspend() noexcept { return {}; }
+      auto final_suspend() noexcept {
+        struct final_awaiter {
+          bool await_ready() noexcept { return false; }
+          std::coroutine_handle<>
+          await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+            // the frame (and the task in it) is gone before join may release
+            // the arena
+            task_group &group = handle.promise().group;
+            handle.destroy();
+            return group.leave();
+          }
+          void await_resume() noexcept {}
+        };
+
+        return final_awaiter{};
+      }
+      void return_void() {}
+      void unhandled_exception() { group.fail(std::current_exception()); }
+
+      task_group &group;
+    };
+  };
+
+  // the frame is allocated by frame_allocated's allocator_arg operator new and
+  // freed by its sized operator delete, which hands it back to the arena
+  // through the frame's trailer: gcc cannot see that they match (coroutine
+  // frames are never freed by a placement delete, so there is none to add)
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+  template <typename Task>
+  static child run(std::allocator_arg_t, std::pmr::memory_resource *,
+                   task_group &, Task task) {
+    co_await task;
+  }
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+  struct join_awaiter {
+    task_group &group;
+    std::optional<std::stop_callback<detail::forward_stop>> parent;
+
+    bool await_ready() const noexcept {
+      return group.remaining.load(std::memory_order_acquire) == 1;
+    }
+    template <typename P> bool await_suspend(std::coroutine_handle<P> handle) {
+      group.continuation = handle;
+      if (auto token = detail::inherited_stop_token(handle);
+          token.stop_possible())
+        parent.emplace(std::move(token), detail::forward_stop{&group.source});
+
+      return group.remaining.fetch_sub(1, std::memory_order_acq_rel) != 1;
+    }
+    void await_resume() {
+      parent.reset();
+      group.reset();
+    }
+  };
+
+  // a child completed, the last one resumes join
+  std::coroutine_handle<> leave() noexcept {
+    if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      return continuation;
+    return std::noop_coroutine();
+  }
+  void fail(std::exception_ptr error) noexcept;
+  // after join: release the arena, rethrow the first exception
+  void reset();
+
+  std::unique_ptr<std::byte[]> buffer;
+  std::pmr::monotonic_buffer_resource arena;
+
+  // running children plus one held by the group until join suspends
+  std::atomic<std::size_t> remaining = 1;
+  std::coroutine_handle<> continuation;
+
+  std::stop_source source;
+  std::atomic<bool> failed = false;
+  std::exception_ptr exception;
+};
+
+} // namespace coro
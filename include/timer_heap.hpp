@@ -0,0 +1,110 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace coro::detail {
+
+/*
+min-heap of pending deadlines (4-ary, so it stays shallow and cache friendly)
+
+T has to provide `timeout` (ordered) and `timer_index` (its position in the
+heap, maintained by the heap) so that entries can be removed in O(log n)
+*/
+template <typename T> class timer_heap {
+public:
+  static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+  bool empty() const { return heap.empty(); }
+  std::size_t size() const { return heap.size(); }
+
+  // entry with the nearest deadline in O(1)
+  T *top() const {
+    assert(!heap.empty());
+    return heap.front();
+  }
+
+  void push(T *entry) {
+    entry->timer_index = heap.size();
+    heap.push_back(entry);
+    sift_up(entry->timer_index);
+  }
+
+  T *pop() {
+    T *entry = top();
+    erase(entry);
+    return entry;
+  }
+
+  // remove entry from the heap (no-op if it is not there)
+  void erase(T *entry) {
+    std::size_t index = entry->timer_index;
+    if (index == npos)
+      return;
+
+    assert(heap[index] == entry);
+    entry->timer_index = npos;
+
+    T *last = heap.back();
+    heap.pop_back();
+    if (last == entry)
+      return;
+
+    place(index, last);
+    sift_up(index);
+    sift_down(last->timer_index);
+  }
+
+  auto begin() const { return heap.begin(); }
+  auto end() const { return heap.end(); }
+
+private:
+  static constexpr std::size_t arity = 4;
+
+  void place(std::size_t index, T *entry) {
+    heap[index] = entry;
+    entry->timer_index = index;
+  }
+
+  void sift_up(std::size_t index) {
+    T *entry = heap[index];
+    while (index > 0) {
+      std::size_t parent = (index - 1) / arity;
+      if (!(entry->timeout < heap[parent]->timeout))
+        break;
+
+      place(index, heap[parent]);
+      index = parent;
+    }
+    place(index, entry);
+  }
+
+  void sift_down(std::size_t index) {
+    T *entry = heap[index];
+    while (true) {
+      std::size_t first = index * arity + 1;
+      if (first >= heap.size())
+        break;
+
+      std::size_t last = std::min(first + arity, heap.size());
+      std::size_t best = first;
+      for (std::size_t child = first + 1; child < last; ++child)
+        if (heap[child]->timeout < heap[best]->timeout)
+          best = child;
+
+      if (!(heap[best]->timeout < entry->timeout))
+        break;
+
+      place(index, heap[best]);
+      index = best;
+    }
+    place(index, entry);
+  }
+
+  std::vector<T *> heap;
+};
+
+} // namespace coro::detail
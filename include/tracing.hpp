@@ -0,0 +1,189 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+namespace coro {
+
+// suspensions and resumptions are traced only if built with
+// CORO_ASYNCIO_TRACING (it adds the caller link to the task promises)
+#ifdef CORO_ASYNCIO_TRACING
+inline constexpr bool tracing_enabled = true;
+#else
+inline constexpr bool tracing_enabled = false;
+#endif
+
+enum class trace_kind : std::uint8_t {
+  // the coroutine started waiting in an engine
+  suspend,
+  // the engine resumed it, duration is how long it ran until it suspended
+  resume,
+};
+
+struct trace_event {
+  trace_kind kind;
+  // recording thread (numbered in order of their first event)
+  std::uint32_t thread;
+  // steady_clock nanoseconds
+  std::uint64_t time;
+  std::uint64_t duration;
+  // frame of the coroutine
+  const void *coroutine;
+  // awaited fd (-1 for timers) and the operation ("poll", "read"...)
+  int fd;
+  const char *operation;
+  // steady_clock nanoseconds, none if it waits without one
+  std::optional<std::uint64_t> deadline;
+};
+
+// a coroutine waiting in an engine, see basic_io_engine::suspended
+struct suspended_coroutine {
+  const char *operation;
+  int fd;
+  std::optional<std::chrono::steady_clock::time_point> deadline;
+  // since the suspension (zero unless tracing is enabled)
+  std::chrono::nanoseconds waiting{0};
+  // frames of the waiting coroutine and of the tasks awaiting it, innermost
+  // first (only the waiting one unless tracing is enabled)
+  std::vector<const void *> stack;
+};
+
+// events of all threads still in their buffers (the last trace_capacity per
+// thread), ordered by time; may be called from any thread while they record
+std::vector<trace_event> collect_trace();
+
+// as Chrome trace event JSON (opened by Perfetto and chrome://tracing):
+// suspensions are async slices of their coroutine named after the operation,
+// resumptions are slices of the thread that ran it
+void write_chrome_trace(std::ostream &out, std::span<const trace_event> events);
+inline void write_chrome_trace(std::ostream &out) {
+  write_chrome_trace(out, collect_trace());
+}
+
+// one line per coroutine followed by its stack, every frame with the
+// location of its coroutine function (addr2line -fCe <object> <offset>)
+void write_stacks(std::ostream &out,
+                  std::span<const suspended_coroutine> coroutines);
+
+namespace detail {
+
+// link of a task to the coroutine awaiting it, the chain of them is the
+// async stack of a suspended coroutine
+struct trace_frame {
+  const void *coroutine = nullptr;
+  const trace_frame *caller = nullptr;
+};
+
+struct no_trace_frame {};
+
+// member of the task promises
+using task_trace =
+    std::conditional_t<tracing_enabled, trace_frame, no_trace_frame>;
+
+template <typename P>
+const trace_frame *trace_frame_of(std::coroutine_handle<P> handle) {
+  if constexpr (tracing_enabled && requires { handle.promise().trace; })
+    return &handle.promise().trace;
+  else
+    return nullptr;
+}
+
+// task of handle is awaited by continuation
+template <typename Promise, typename P>
+void trace_await(std::coroutine_handle<Promise> handle,
+                 std::coroutine_handle<P> continuation) {
+  if constexpr (tracing_enabled) {
+    handle.promise().trace.coroutine = handle.address();
+    handle.promise().trace.caller = trace_frame_of(continuation);
+    // the outermost task is not awaited by anyone
+    if constexpr (requires { continuation.promise().trace; })
+      continuation.promise().trace.coroutine = continuation.address();
+  }
+}
+
+inline constexpr std::size_t trace_capacity = 1 << 14;
+
+/*
+events of one thread: a ring of the last trace_capacity, written only by its
+thread without locks and read by collect_trace from any thread (every slot
+has a sequence number, odd while it is written, torn reads are dropped)
+*/
+class trace_buffer {
+public:
+  explicit trace_buffer(std::uint32_t thread) : thread(thread) {}
+
+  // of the calling thread, registered for collect_trace on first use (kept
+  // after the thread exits)
+  static trace_buffer &local();
+
+  void record(trace_kind kind, std::uint64_t time, std::uint64_t duration,
+              const void *coroutine, int fd, const char *operation,
+              std::optional<std::uint64_t> deadline) {
+    std::uint64_t position = head.load(std::memory_order_relaxed);
+    auto &s = slots[position % trace_capacity];
+
+    s.sequence.store(2 * position + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    s.words[0].store(time, std::memory_order_relaxed);
+    s.words[1].store(duration, std::memory_order_relaxed);
+    s.words[2].store(reinterpret_cast<std::uintptr_t>(coroutine),
+                     std::memory_order_relaxed);
+    s.words[3].store(reinterpret_cast<std::uintptr_t>(operation),
+                     std::memory_order_relaxed);
+    s.words[4].store(deadline.value_or(no_deadline),
+                     std::memory_order_relaxed);
+    s.words[5].store(static_cast<std::uint32_t>(fd) |
+                         static_cast<std::uint64_t>(kind) << 32,
+                     std::memory_order_relaxed);
+    s.sequence.store(2 * position + 2, std::memory_order_release);
+
+    head.store(position + 1, std::memory_order_release);
+  }
+
+  // appends the events that were not overwritten while reading
+  void read(std::vector<trace_event> &events) const;
+
+private:
+  static constexpr std::uint64_t no_deadline = UINT64_MAX;
+
+  struct slot {
+    std::atomic<std::uint64_t> sequence = 0;
+    std::array<std::atomic<std::uint64_t>, 6> words{};
+  };
+
+  std::uint32_t thread;
+  std::atomic<std::uint64_t> head = 0;
+  std::array<slot, trace_capacity> slots{};
+};
+
+inline std::uint64_t trace_clock() {
+  return static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count());
+}
+
+// the trace point of an operation: where its coroutine waits and since when
+struct trace_point {
+  const trace_frame *frame = nullptr;
+  std::uint64_t since = 0;
+};
+
+struct no_trace_point {};
+
+// member of the engine's operations
+using operation_trace =
+    std::conditional_t<tracing_enabled, trace_point, no_trace_point>;
+
+} // namespace detail
+
+} // namespace coro
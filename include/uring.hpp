@@ -0,0 +1,81 @@
+#pragma once
+
+#include <linux/io_uring.h>
+
+#include <atomic>
+#include <cstddef>
+#include <ctime>
+
+namespace coro::detail {
+
+// minimal io_uring wrapper on top of raw syscalls (no liburing dependency)
+class uring {
+public:
+  // with sqpoll_idle (milliseconds) a kernel thread polls the submission
+  // queue and sleeps after that long without submissions (if the kernel
+  // allows it)
+  explicit uring(unsigned entries, unsigned sqpoll_idle = 0);
+  uring(const uring &) = delete;
+  uring &operator=(const uring &) = delete;
+
+  ~uring();
+
+  // zeroed submission entry or nullptr if the submission queue is full
+  io_uring_sqe *get_sqe();
+
+  // number of entries queued with get_sqe that were not submitted yet
+  unsigned pending() const { return sqe_tail - submitted; }
+
+  // submit everything queued and wait for at least `min_complete`
+  // completions (at most `timeout` if it is not nullptr)
+  // returns -errno on failure (-ETIME when the timeout expired)
+  int enter(unsigned min_complete, const timespec *timeout = nullptr);
+
+  // consume all available completion entries
+  template <typename F> unsigned for_each_cqe(F &&f) {
+    unsigned head = *cq_head;
+    unsigned tail = std::atomic_ref(*cq_tail).load(std::memory_order_acquire);
+    unsigned n = tail - head;
+
+    for (; head != tail; ++head)
+      f(cqes[head & cq_mask]);
+
+    std::atomic_ref(*cq_head).store(head, std::memory_order_release);
+    return n;
+  }
+
+  // io_uring_register, returns -errno on failure
+  int register_resource(unsigned opcode, const void *arg, unsigned count);
+
+  int fd() const { return ring_fd; }
+
+private:
+  void release();
+
+  int ring_fd = -1;
+  unsigned sq_entries;
+
+  void *sq_ptr = nullptr;
+  std::size_t sq_size = 0;
+  void *cq_ptr = nullptr;
+  std::size_t cq_size = 0;
+  io_uring_sqe *sqes = nullptr;
+  std::size_t sqes_size = 0;
+
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_flags;
+  unsigned sq_mask;
+  bool sqpoll = false;
+
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned cq_mask;
+  io_uring_cqe *cqes;
+
+  // locally queued (not yet published) submission tail
+  unsigned sqe_tail = 0;
+  unsigned submitted = 0;
+};
+
+} // namespace coro::detail
@@ -2,14 +2,18 @@
 
 #include <unistd.h>
 
+#include <chrono>
 #include <exception>
+#include <string>
 #include <string_view>
 #include <utility>
 
 namespace utils {
 
 [[noreturn]] void throw_sys_error(std::string msg);
+[[noreturn]] void throw_sys_error(int err, std::string msg);
 std::exception_ptr make_sys_error(std::string msg);
+std::exception_ptr make_sys_error(int err, std::string msg);
 
 // RAII wrapper for file descriptor
 class handle {
@@ -37,4 +41,9 @@ private:
   int h;
 };
 
+// ask the kernel to busy poll the device queue of a socket for up to
+// duration when reading it would block (SO_BUSY_POLL), false if it is not
+// supported or not permitted (raising it needs CAP_NET_ADMIN)
+bool set_busy_poll(const handle &socket, std::chrono::microseconds duration);
+
 } // namespace utils
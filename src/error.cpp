@@ -0,0 +1,30 @@
+#include "error.hpp"
+
+#include <string>
+#include <system_error>
+
+namespace {
+struct io_category_impl : std::error_category {
+  const char *name() const noexcept override { return "coro.io"; }
+
+  std::string message(int ev) const override {
+    switch (static_cast<coro::io_errc>(ev)) {
+    case coro::io_errc::pollerr:
+      return "POLLERR";
+    case coro::io_errc::pollhup:
+      return "POLLHUP";
+    case coro::io_errc::pollnval:
+      return "POLLNVAL";
+    case coro::io_errc::engine_destroyed:
+      return "io_engine destroyed";
+    }
+
+    return "unknown io error";
+  }
+};
+} // namespace
+
+const std::error_category &coro::io_category() noexcept {
+  static const io_category_impl category;
+  return category;
+}
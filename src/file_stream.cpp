@@ -0,0 +1,266 @@
+#include "file_stream.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <coroutine>
+#include <memory>
+#include <new>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+using namespace coro;
+
+namespace {
+
+using chunk_generator = async_generator<std::span<const std::byte>>;
+
+// of the offsets, lengths and buffers of O_DIRECT reads (the logical block
+// size of common devices is at most that)
+constexpr std::size_t direct_alignment = 4096;
+
+std::size_t file_size(const utils::handle &fd) {
+  struct stat st;
+  if (::fstat(static_cast<int>(fd), &st) == -1)
+    utils::throw_sys_error("fstat");
+
+  return static_cast<std::size_t>(st.st_size);
+}
+
+std::size_t round_up(std::size_t value, std::size_t multiple) {
+  return (std::max<std::size_t>(value, 1) + multiple - 1) / multiple *
+         multiple;
+}
+
+struct mapping {
+  void *base = MAP_FAILED;
+  std::size_t size = 0;
+
+  ~mapping() {
+    if (base != MAP_FAILED)
+      ::munmap(base, size);
+  }
+};
+
+chunk_generator stream_mapped(io_engine &engine, const utils::handle &fd,
+                              file_stream_options opts) {
+  std::size_t size = file_size(fd);
+  if (size == 0)
+    co_return;
+
+  mapping map;
+  map.base = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE,
+                    static_cast<int>(fd), 0);
+  if (map.base == MAP_FAILED)
+    utils::throw_sys_error("mmap");
+  map.size = size;
+  ::madvise(map.base, size, MADV_SEQUENTIAL);
+
+  auto *data = static_cast<std::byte *>(map.base);
+  std::size_t chunk = std::max<std::size_t>(opts.chunk_size, 1);
+  // whole pages, as madvise wants them
+  auto page = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+  std::size_t window = round_up(std::max(opts.readahead, chunk), page);
+
+  // the window after the consumer's one is always being read ahead
+  std::size_t advised = 0;
+  for (std::size_t offset = 0; offset < size; offset += chunk) {
+    bool advanced = false;
+    while (advised < size && offset + window >= advised) {
+      std::size_t length = std::min(window, size - advised);
+      ::madvise(data + advised, length, MADV_WILLNEED);
+      advised += length;
+      advanced = offset > 0;
+    }
+
+    // a window may have been faulted in on the engine's thread, give the
+    // other coroutines a turn (defer stays on this thread, schedule would go
+    // through the posted stack and its eventfd)
+    if (advanced)
+      co_await engine.defer();
+
+    co_yield std::span<const std::byte>(data + offset,
+                                        std::min(chunk, size - offset));
+  }
+}
+
+struct aligned_buffers {
+  explicit aligned_buffers(std::size_t size)
+      : data(static_cast<std::byte *>(::operator new[](
+            size, std::align_val_t{direct_alignment}))) {}
+  aligned_buffers(const aligned_buffers &) = delete;
+  aligned_buffers &operator=(const aligned_buffers &) = delete;
+
+  ~aligned_buffers() {
+    ::operator delete[](data, std::align_val_t{direct_alignment});
+  }
+
+  std::byte *data;
+};
+
+// buffers of a direct stream and the reads filling them, shared with the
+// reads in flight so that the stream may go away before they complete
+struct direct_reads {
+  struct slot {
+    std::byte *buffer;
+    bool done = false;
+    io_engine::result<std::size_t> result;
+    // the stream waiting for this read
+    std::coroutine_handle<> waiter;
+  };
+
+  direct_reads(std::size_t chunk, std::size_t count)
+      : chunk(chunk), buffers(chunk * count), slots(count) {
+    for (std::size_t i = 0; i < count; ++i)
+      slots[i].buffer = buffers.data + i * chunk;
+  }
+
+  std::size_t chunk;
+  aligned_buffers buffers;
+  std::vector<slot> slots;
+};
+
+// into the slot's buffer after its first filled bytes
+task read_chunk(io_engine &engine, const utils::handle &fd,
+                std::shared_ptr<direct_reads> reads, std::size_t index,
+                off_t offset, std::size_t filled) {
+  auto &slot = reads->slots[index];
+  slot.result = co_await engine.async_read_at(
+      fd, {slot.buffer + filled, reads->chunk - filled},
+      offset + static_cast<off_t>(filled), std::nothrow);
+  slot.done = true;
+  if (auto waiter = std::exchange(slot.waiter, nullptr))
+    waiter.resume();
+}
+
+chunk_generator stream_direct(io_engine &engine, const utils::handle &fd,
+                              file_stream_options opts) {
+  std::size_t size = file_size(fd);
+  std::size_t chunk = round_up(opts.chunk_size, direct_alignment);
+
+  // regular files are always ready to the readiness backends, the reads are
+  // done right away then
+  if (engine.backend_kind() != io_engine::backend::io_uring) {
+    aligned_buffers buffer(chunk);
+    for (std::size_t offset = 0; offset < size; offset += chunk) {
+      // short reads are continued (an unaligned rest fails with EINVAL under
+      // O_DIRECT rather than skipping bytes)
+      std::size_t expected = std::min(chunk, size - offset);
+      std::size_t filled = 0;
+      while (filled < expected) {
+        ssize_t n;
+        do
+          n = ::pread(static_cast<int>(fd), buffer.data + filled,
+                      chunk - filled, static_cast<off_t>(offset + filled));
+        while (n == -1 && errno == EINTR);
+        if (n == -1)
+          utils::throw_sys_error("pread");
+        // the file was truncated meanwhile
+        if (n == 0)
+          break;
+        filled += static_cast<std::size_t>(n);
+      }
+      if (filled == 0)
+        co_return;
+
+      co_yield std::span<const std::byte>(buffer.data, filled);
+      if (filled < expected)
+        co_return;
+      co_await engine.defer();
+    }
+    co_return;
+  }
+
+  std::size_t count = std::max<std::size_t>(opts.in_flight, 1);
+  auto reads = std::make_shared<direct_reads>(chunk, count);
+  // reads completing after the stream is gone have nobody to resume
+  struct abandon {
+    direct_reads &reads;
+    ~abandon() {
+      for (auto &slot : reads.slots)
+        slot.waiter = nullptr;
+    }
+  } guard{*reads};
+
+  struct slot_awaiter {
+    direct_reads::slot &slot;
+
+    bool await_ready() const noexcept { return slot.done; }
+    void await_suspend(std::coroutine_handle<> handle) noexcept {
+      slot.waiter = handle;
+    }
+    void await_resume() const noexcept {}
+  };
+
+  std::size_t chunks = (size + chunk - 1) / chunk;
+  std::size_t next = 0;
+  auto read = [&](std::size_t index, std::size_t offset, std::size_t filled) {
+    reads->slots[index].done = false;
+    read_chunk(engine, fd, reads, index, static_cast<off_t>(offset), filled);
+  };
+  for (; next < std::min(count, chunks); ++next)
+    read(next, next * chunk, 0);
+
+  for (std::size_t i = 0; i < chunks; ++i) {
+    auto &slot = reads->slots[i % count];
+    std::size_t offset = i * chunk;
+    std::size_t expected = std::min(chunk, size - offset);
+    // short reads are continued as with pread
+    std::size_t filled = 0;
+    for (;;) {
+      co_await slot_awaiter{slot};
+      if (!slot.result)
+        throw std::system_error(slot.result.error(), "read");
+      filled += *slot.result;
+      // done or the file was truncated meanwhile
+      if (filled >= expected || *slot.result == 0)
+        break;
+      read(i % count, offset, filled);
+    }
+    if (filled == 0)
+      co_return;
+
+    co_yield std::span<const std::byte>(slot.buffer, filled);
+    if (filled < expected)
+      co_return;
+    if (next < chunks) {
+      read(i % count, next * chunk, 0);
+      ++next;
+    }
+  }
+}
+
+} // namespace
+
+chunk_generator coro::stream_file(io_engine &engine, const utils::handle &fd,
+                                  file_stream_options opts) {
+  if (opts.mode == file_mode::direct)
+    return stream_direct(engine, fd, opts);
+  return stream_mapped(engine, fd, opts);
+}
+
+chunk_generator coro::stream_file(io_engine &engine, std::string path,
+                                  file_stream_options opts) {
+  utils::handle fd;
+  if (opts.mode == file_mode::direct) {
+    fd = utils::handle(::open(path.c_str(), O_RDONLY | O_CLOEXEC | O_DIRECT));
+    // EINVAL: the filesystem does not support O_DIRECT, go through the page
+    // cache
+    if (!fd && errno != EINVAL)
+      utils::throw_sys_error("open " + path);
+  }
+  if (!fd) {
+    fd = utils::handle(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (!fd)
+      utils::throw_sys_error("open " + path);
+  }
+
+  auto chunks = stream_file(engine, fd, opts);
+  for (auto it = co_await chunks.begin(); it != chunks.end(); co_await ++it)
+    co_yield *it;
+}
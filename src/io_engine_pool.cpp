@@ -0,0 +1,221 @@
+#include "io_engine_pool.hpp"
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <system_error>
+#include <thread>
+
+using namespace coro;
+
+namespace {
+// bounded ring owned by a single worker: only the owner pushes (at the tail),
+// the owner and thieves take from the head with a CAS, so it stays FIFO and
+// lock-free
+class local_queue {
+public:
+  static constexpr std::uint32_t capacity = 256;
+
+  bool push(std::coroutine_handle<> handle) {
+    std::uint32_t t = tail.load(std::memory_order_relaxed);
+    std::uint32_t h = head.load(std::memory_order_acquire);
+    if (t - h >= capacity)
+      return false;
+
+    slots[t % capacity].store(handle.address(), std::memory_order_relaxed);
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  std::coroutine_handle<> pop() {
+    std::uint32_t h = head.load(std::memory_order_acquire);
+    while (true) {
+      std::uint32_t t = tail.load(std::memory_order_acquire);
+      if (h == t)
+        return nullptr;
+
+      void *address = slots[h % capacity].load(std::memory_order_relaxed);
+      if (head.compare_exchange_weak(h, h + 1, std::memory_order_acq_rel,
+                                     std::memory_order_acquire))
+        return std::coroutine_handle<>::from_address(address);
+    }
+  }
+
+  bool empty() const {
+    return head.load(std::memory_order_acquire) ==
+           tail.load(std::memory_order_acquire);
+  }
+
+private:
+  std::atomic<std::uint32_t> head = 0;
+  std::atomic<std::uint32_t> tail = 0;
+  std::atomic<void *> slots[capacity] = {};
+};
+
+// number of coroutines run between checks for io
+constexpr int batch_size = 64;
+} // namespace
+
+struct io_engine_pool::worker {
+  worker(io_engine_pool &pool, std::size_t index, io_engine::options opts)
+      : pool(pool), index(index), engine(opts) {}
+
+  void wake() { engine.wake(); }
+
+  io_engine_pool &pool;
+  std::size_t index;
+
+  io_engine engine;
+  local_queue queue;
+
+  std::atomic<bool> sleeping = false;
+
+  std::thread thread;
+};
+
+thread_local io_engine_pool::worker *io_engine_pool::current = nullptr;
+
+io_engine_pool::io_engine_pool(options opts) {
+  std::size_t threads = opts.threads;
+  if (threads == 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+
+  workers.reserve(threads);
+  for (std::size_t i = 0; i < threads; ++i)
+    workers.push_back(std::make_unique<worker>(*this, i, opts.engine));
+
+  try {
+    unsigned cpus = std::max(1u, std::thread::hardware_concurrency());
+    for (auto &w : workers) {
+      w->thread = std::thread([this, &w = *w] { run(w); });
+
+      if (opts.pin) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(w->index % cpus, &set);
+
+        int err = ::pthread_setaffinity_np(w->thread.native_handle(),
+                                           sizeof(set), &set);
+        if (err)
+          utils::throw_sys_error(err, "pthread_setaffinity_np");
+      }
+    }
+  } catch (...) {
+    stop();
+    throw;
+  }
+}
+
+io_engine_pool::~io_engine_pool() { stop(); }
+
+void io_engine_pool::stop() {
+  stopping.store(true, std::memory_order_release);
+
+  for (auto &w : workers)
+    w->wake();
+
+  for (auto &w : workers)
+    if (w->thread.joinable())
+      w->thread.join();
+}
+
+io_engine &io_engine_pool::engine(std::size_t worker) {
+  return workers.at(worker)->engine;
+}
+
+io_engine *io_engine_pool::current_engine() {
+  return current ? &current->engine : nullptr;
+}
+
+void io_engine_pool::submit(std::coroutine_handle<> handle) {
+  if (!current || &current->pool != this || !current->queue.push(handle)) {
+    std::lock_guard lock(injected_mutex);
+    injected.push_back(handle);
+    injected_size.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  notify();
+}
+
+void io_engine_pool::notify() {
+  // pairs with the fence of a worker going to sleep
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (idle.load(std::memory_order_relaxed) == 0)
+    return;
+
+  for (auto &w : workers) {
+    if (w->sleeping.exchange(false)) {
+      w->wake();
+      return;
+    }
+  }
+}
+
+bool io_engine_pool::has_work(const worker &w) const {
+  if (!w.queue.empty() || injected_size.load(std::memory_order_relaxed) > 0)
+    return true;
+
+  for (auto &other : workers)
+    if (!other->queue.empty())
+      return true;
+
+  return false;
+}
+
+std::coroutine_handle<> io_engine_pool::next(worker &w) {
+  if (auto handle = w.queue.pop())
+    return handle;
+
+  if (injected_size.load(std::memory_order_relaxed) > 0) {
+    std::lock_guard lock(injected_mutex);
+    if (!injected.empty()) {
+      auto handle = injected.front();
+      injected.pop_front();
+      injected_size.fetch_sub(1, std::memory_order_relaxed);
+      return handle;
+    }
+  }
+
+  // steal from the others (starting with the next one)
+  for (std::size_t i = 1; i < workers.size(); ++i) {
+    auto &victim = *workers[(w.index + i) % workers.size()];
+    if (auto handle = victim.queue.pop())
+      return handle;
+  }
+
+  return nullptr;
+}
+
+void io_engine_pool::run(worker &w) {
+  current = &w;
+
+  while (!stopping.load(std::memory_order_acquire)) {
+    for (int i = 0; i < batch_size; ++i) {
+      auto handle = next(w);
+      if (!handle)
+        break;
+
+      handle.resume();
+    }
+
+    w.engine.pull();
+    if (has_work(w))
+      continue;
+
+    w.sleeping.store(true);
+    idle.fetch_add(1);
+    // pairs with the fence in notify
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (!has_work(w) && !stopping.load(std::memory_order_acquire))
+      w.engine.pull_wait();
+
+    idle.fetch_sub(1);
+    w.sleeping.store(false);
+  }
+
+  current = nullptr;
+}
@@ -0,0 +1,108 @@
+#include "sync.hpp"
+
+#include <cassert>
+
+using namespace coro;
+
+bool async_mutex::try_lock() {
+  std::uintptr_t expected = not_locked;
+  return state.compare_exchange_strong(expected, locked_no_waiters,
+                                       std::memory_order_acquire,
+                                       std::memory_order_relaxed);
+}
+
+bool async_mutex::lock_awaiter::await_suspend(std::coroutine_handle<> handle) {
+  suspend(handle);
+
+  std::uintptr_t old = mutex.state.load(std::memory_order_acquire);
+  while (true) {
+    if (old == not_locked) {
+      if (mutex.state.compare_exchange_weak(old, locked_no_waiters,
+                                            std::memory_order_acquire,
+                                            std::memory_order_relaxed))
+        return false;
+    } else {
+      next = old == locked_no_waiters ? nullptr
+                                      : reinterpret_cast<waiter *>(old);
+      if (mutex.state.compare_exchange_weak(
+              old, reinterpret_cast<std::uintptr_t>(static_cast<waiter *>(this)),
+              std::memory_order_release, std::memory_order_relaxed))
+        return true;
+    }
+  }
+}
+
+void async_mutex::unlock() {
+  assert(state.load(std::memory_order_relaxed) != not_locked);
+
+  waiter *head = waiters;
+  if (!head) {
+    std::uintptr_t old = locked_no_waiters;
+    if (state.compare_exchange_strong(old, not_locked,
+                                      std::memory_order_release,
+                                      std::memory_order_relaxed))
+      return;
+
+    // take the ones that arrived meanwhile, oldest first
+    old = state.exchange(locked_no_waiters, std::memory_order_acquire);
+    auto *w = reinterpret_cast<waiter *>(old);
+    do {
+      waiter *next = w->next;
+      w->next = head;
+      head = w;
+      w = next;
+    } while (w);
+  }
+
+  // the mutex stays locked, it now belongs to head
+  waiters = head->next;
+  detail::sync_access::wake(*head);
+}
+
+bool async_semaphore::try_acquire() {
+  std::size_t available = count.load(std::memory_order_relaxed);
+  while (available > 0)
+    if (count.compare_exchange_weak(available, available - 1,
+                                    std::memory_order_acquire,
+                                    std::memory_order_relaxed))
+      return true;
+  return false;
+}
+
+bool async_semaphore::acquire_awaiter::await_suspend(
+    std::coroutine_handle<> handle) {
+  suspend(handle);
+
+  std::lock_guard lock(semaphore.mutex);
+  semaphore.waiting.fetch_add(1, std::memory_order_relaxed);
+  // pairs with the fence of release: either it sees us waiting or we see its
+  // permit
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+
+  if (semaphore.try_acquire()) {
+    semaphore.waiting.fetch_sub(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  semaphore.waiters.push_back(this);
+  return true;
+}
+
+void async_semaphore::release(std::size_t permits) {
+  count.fetch_add(permits, std::memory_order_release);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (waiting.load(std::memory_order_relaxed) == 0)
+    return;
+
+  detail::waiter_list<waiter> woken;
+  {
+    std::lock_guard lock(mutex);
+    while (!waiters.empty() && try_acquire()) {
+      woken.push_back(waiters.pop_front());
+      waiting.fetch_sub(1, std::memory_order_relaxed);
+    }
+  }
+
+  while (auto *w = woken.pop_front())
+    detail::sync_access::wake(*w);
+}
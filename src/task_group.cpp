@@ -0,0 +1,34 @@
+#include "task_group.hpp"
+
+#include <cassert>
+
+using namespace coro;
+
+task_group::task_group(std::size_t arena_size)
+    : buffer(std::make_unique<std::byte[]>(arena_size)),
+      arena(buffer.get(), arena_size) {}
+
+task_group::~task_group() {
+  assert(remaining.load(std::memory_order_relaxed) == 1);
+}
+
+void task_group::fail(std::exception_ptr error) noexcept {
+  if (failed.exchange(true, std::memory_order_acq_rel))
+    return;
+
+  exception = std::move(error);
+  source.request_stop();
+}
+
+void task_group::reset() {
+  remaining.store(1, std::memory_order_relaxed);
+  continuation = nullptr;
+  arena.release();
+
+  // a stop source cannot be reset, the next children get a fresh one
+  if (source.stop_requested())
+    source = std::stop_source();
+
+  if (failed.exchange(false, std::memory_order_relaxed))
+    std::rethrow_exception(std::exchange(exception, nullptr));
+}
@@ -0,0 +1,203 @@
+#include "tracing.hpp"
+
+#include <dlfcn.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+using namespace coro;
+using namespace coro::detail;
+
+namespace {
+
+// buffers of all threads that recorded something, never freed so that
+// events of exited threads can still be collected
+struct trace_registry {
+  std::mutex mutex;
+  std::vector<std::unique_ptr<trace_buffer>> buffers;
+};
+
+trace_registry &registry() {
+  static trace_registry instance;
+  return instance;
+}
+
+void write_time(std::ostream &out, std::uint64_t nanoseconds) {
+  // trace event timestamps are in microseconds
+  char text[32];
+  std::snprintf(text, sizeof(text), "%" PRIu64 ".%03" PRIu64,
+                nanoseconds / 1000, nanoseconds % 1000);
+  out << text;
+}
+
+void write_pointer(std::ostream &out, const void *pointer) {
+  char text[24];
+  std::snprintf(text, sizeof(text), "0x%" PRIxPTR,
+                reinterpret_cast<std::uintptr_t>(pointer));
+  out << text;
+}
+
+// the coroutine function of a frame: GCC and Clang put the pointer to its
+// resume function first, written as object+offset (for addr2line, the resume
+// functions are local symbols dladdr cannot name)
+void write_frame(std::ostream &out, const void *coroutine) {
+  write_pointer(out, coroutine);
+
+  auto resume = *static_cast<void *const *>(coroutine);
+  Dl_info info;
+  if (!resume || !::dladdr(resume, &info) || !info.dli_fname)
+    return;
+
+  out << " in " << info.dli_fname << '+';
+  write_pointer(out, reinterpret_cast<const void *>(
+                         static_cast<const char *>(resume) -
+                         static_cast<const char *>(info.dli_fbase)));
+}
+
+} // namespace
+
+trace_buffer &trace_buffer::local() {
+  thread_local trace_buffer *buffer = [] {
+    auto &r = registry();
+    std::lock_guard lock(r.mutex);
+    auto thread = static_cast<std::uint32_t>(r.buffers.size());
+    return r.buffers.emplace_back(std::make_unique<trace_buffer>(thread))
+        .get();
+  }();
+  return *buffer;
+}
+
+void trace_buffer::read(std::vector<trace_event> &events) const {
+  std::uint64_t end = head.load(std::memory_order_acquire);
+  std::uint64_t begin = end > trace_capacity ? end - trace_capacity : 0;
+
+  for (std::uint64_t position = begin; position < end; ++position) {
+    auto &s = slots[position % trace_capacity];
+    if (s.sequence.load(std::memory_order_acquire) != 2 * position + 2)
+      continue;
+
+    std::array<std::uint64_t, 6> words;
+    for (std::size_t i = 0; i < words.size(); ++i)
+      words[i] = s.words[i].load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    // overwritten meanwhile
+    if (s.sequence.load(std::memory_order_relaxed) != 2 * position + 2)
+      continue;
+
+    trace_event event{
+        .kind = static_cast<trace_kind>(words[5] >> 32),
+        .thread = thread,
+        .time = words[0],
+        .duration = words[1],
+        .coroutine = reinterpret_cast<const void *>(words[2]),
+        .fd = static_cast<int>(static_cast<std::uint32_t>(words[5])),
+        .operation = reinterpret_cast<const char *>(words[3]),
+        .deadline = std::nullopt,
+    };
+    if (words[4] != no_deadline)
+      event.deadline = words[4];
+    events.push_back(event);
+  }
+}
+
+std::vector<trace_event> coro::collect_trace() {
+  std::vector<trace_event> events;
+  {
+    auto &r = registry();
+    std::lock_guard lock(r.mutex);
+    for (auto &buffer : r.buffers)
+      buffer->read(events);
+  }
+
+  std::ranges::stable_sort(events, {}, &trace_event::time);
+  return events;
+}
+
+void coro::write_chrome_trace(std::ostream &out,
+                              std::span<const trace_event> events) {
+  auto pid = ::getpid();
+  // async slices end with the name they began with
+  std::unordered_map<const void *, const char *> waiting;
+
+  out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+  bool first = true;
+  auto begin_event = [&](const char *name, const char *phase,
+                         std::uint32_t thread, std::uint64_t time) {
+    out << (std::exchange(first, false) ? "\n" : ",\n");
+    out << "{\"name\":\"" << name << "\",\"cat\":\"coro\",\"ph\":\"" << phase
+        << "\",\"pid\":" << pid << ",\"tid\":" << thread << ",\"ts\":";
+    write_time(out, time);
+  };
+  auto write_id = [&](const void *coroutine) {
+    out << ",\"id\":\"";
+    write_pointer(out, coroutine);
+    out << '"';
+  };
+
+  for (auto &event : events) {
+    if (event.kind == trace_kind::suspend) {
+      waiting[event.coroutine] = event.operation;
+
+      begin_event(event.operation, "b", event.thread, event.time);
+      write_id(event.coroutine);
+      out << ",\"args\":{\"fd\":" << event.fd;
+      if (event.deadline) {
+        out << ",\"deadline_us\":";
+        write_time(out, *event.deadline);
+      }
+      out << "}}";
+      continue;
+    }
+
+    if (auto it = waiting.find(event.coroutine); it != waiting.end()) {
+      begin_event(it->second, "e", event.thread, event.time);
+      write_id(event.coroutine);
+      out << '}';
+      waiting.erase(it);
+    }
+
+    begin_event("resume", "X", event.thread, event.time);
+    out << ",\"dur\":";
+    write_time(out, event.duration);
+    out << ",\"args\":{\"coroutine\":\"";
+    write_pointer(out, event.coroutine);
+    out << "\"}}";
+  }
+
+  out << "\n]}\n";
+}
+
+void coro::write_stacks(std::ostream &out,
+                        std::span<const suspended_coroutine> coroutines) {
+  for (auto &coroutine : coroutines) {
+    out << coroutine.operation;
+    if (coroutine.fd != -1)
+      out << " fd " << coroutine.fd;
+    if (coroutine.waiting.count())
+      out << " waiting "
+          << std::chrono::duration_cast<std::chrono::microseconds>(
+                 coroutine.waiting)
+                 .count()
+          << "us";
+    if (coroutine.deadline) {
+      auto left = *coroutine.deadline - std::chrono::steady_clock::now();
+      out << " deadline in "
+          << std::chrono::duration_cast<std::chrono::microseconds>(left)
+                 .count()
+          << "us";
+    }
+    out << '\n';
+
+    for (std::size_t i = 0; i < coroutine.stack.size(); ++i) {
+      out << "  #" << i << ' ';
+      write_frame(out, coroutine.stack[i]);
+      out << '\n';
+    }
+  }
+}
@@ -0,0 +1,192 @@
+#include "uring.hpp"
+
+#include "utils.hpp"
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+
+using namespace coro::detail;
+
+namespace {
+int sys_io_uring_setup(unsigned entries, io_uring_params *p) {
+  return static_cast<int>(::syscall(__NR_io_uring_setup, entries, p));
+}
+
+int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                       unsigned flags, const void *arg, std::size_t argsz) {
+  return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit,
+                                    min_complete, flags, arg, argsz));
+}
+
+int sys_io_uring_register(int fd, unsigned opcode, const void *arg,
+                          unsigned nr_args) {
+  return static_cast<int>(
+      ::syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+void *map_ring(int fd, std::size_t size, off_t offset) {
+  void *ptr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, offset);
+  if (ptr == MAP_FAILED)
+    utils::throw_sys_error("io_uring mmap");
+  return ptr;
+}
+} // namespace
+
+uring::uring(unsigned entries, unsigned sqpoll_idle) {
+  io_uring_params p;
+  std::memset(&p, 0, sizeof(p));
+
+  if (sqpoll_idle) {
+    p.flags = IORING_SETUP_SQPOLL;
+    p.sq_thread_idle = sqpoll_idle;
+    ring_fd = sys_io_uring_setup(entries, &p);
+
+    // needs privileges on older kernels, submit by ourselves then
+    sqpoll = ring_fd >= 0;
+    if (!sqpoll)
+      std::memset(&p, 0, sizeof(p));
+  }
+
+  if (!sqpoll)
+    ring_fd = sys_io_uring_setup(entries, &p);
+  if (ring_fd < 0)
+    utils::throw_sys_error("io_uring_setup");
+
+  if (!(p.features & IORING_FEAT_EXT_ARG)) {
+    ::close(ring_fd);
+    errno = ENOSYS;
+    utils::throw_sys_error("io_uring_setup (IORING_FEAT_EXT_ARG)");
+  }
+
+  sq_entries = p.sq_entries;
+  sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+  sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+
+  try {
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+      sq_size = cq_size = std::max(sq_size, cq_size);
+      sq_ptr = cq_ptr = map_ring(ring_fd, sq_size, IORING_OFF_SQ_RING);
+    } else {
+      sq_ptr = map_ring(ring_fd, sq_size, IORING_OFF_SQ_RING);
+      cq_ptr = map_ring(ring_fd, cq_size, IORING_OFF_CQ_RING);
+    }
+
+    sqes = static_cast<io_uring_sqe *>(
+        map_ring(ring_fd, sqes_size, IORING_OFF_SQES));
+  } catch (...) {
+    release();
+    throw;
+  }
+
+  auto *sq = static_cast<char *>(sq_ptr);
+  sq_head = reinterpret_cast<unsigned *>(sq + p.sq_off.head);
+  sq_tail = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+  sq_flags = reinterpret_cast<unsigned *>(sq + p.sq_off.flags);
+  sq_mask = *reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+
+  // submission entries are always used in ring order
+  auto *array = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+  for (unsigned i = 0; i < sq_entries; ++i)
+    array[i] = i;
+
+  auto *cq = static_cast<char *>(cq_ptr);
+  cq_head = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+  cq_tail = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+  cq_mask = *reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+  cqes = reinterpret_cast<io_uring_cqe *>(cq + p.cq_off.cqes);
+
+  sqe_tail = submitted = *sq_tail;
+}
+
+uring::~uring() { release(); }
+
+void uring::release() {
+  if (sqes)
+    ::munmap(sqes, sqes_size);
+  if (cq_ptr && cq_ptr != sq_ptr)
+    ::munmap(cq_ptr, cq_size);
+  if (sq_ptr)
+    ::munmap(sq_ptr, sq_size);
+  if (ring_fd >= 0)
+    ::close(ring_fd);
+}
+
+io_uring_sqe *uring::get_sqe() {
+  unsigned head = std::atomic_ref(*sq_head).load(std::memory_order_acquire);
+  if (sqe_tail - head >= sq_entries)
+    return nullptr;
+
+  io_uring_sqe *sqe = &sqes[sqe_tail & sq_mask];
+  ++sqe_tail;
+
+  std::memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+int uring::enter(unsigned min_complete, const timespec *timeout) {
+  std::atomic_ref(*sq_tail).store(sqe_tail, std::memory_order_release);
+
+  unsigned flags = 0;
+  if (min_complete > 0)
+    flags |= IORING_ENTER_GETEVENTS;
+
+  if (sqpoll) {
+    // the kernel thread takes what was published, it only has to be woken up
+    // once it went idle (or waited for if the queue is full)
+    submitted = sqe_tail;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (std::atomic_ref(*sq_flags).load(std::memory_order_relaxed) &
+        IORING_SQ_NEED_WAKEUP)
+      flags |= IORING_ENTER_SQ_WAKEUP;
+    if (sqe_tail - std::atomic_ref(*sq_head).load(std::memory_order_acquire) >=
+        sq_entries)
+      flags |= IORING_ENTER_SQ_WAIT;
+
+    if (!flags && !timeout)
+      return 0;
+  }
+
+  io_uring_getevents_arg arg{};
+  __kernel_timespec ts{};
+  const void *argp = nullptr;
+  std::size_t argsz = 0;
+
+  if (timeout) {
+    ts.tv_sec = timeout->tv_sec;
+    ts.tv_nsec = timeout->tv_nsec;
+
+    flags |= IORING_ENTER_EXT_ARG | IORING_ENTER_GETEVENTS;
+    arg.sigmask_sz = _NSIG / 8;
+    arg.ts = reinterpret_cast<std::uint64_t>(&ts);
+    argp = &arg;
+    argsz = sizeof(arg);
+  }
+
+  while (true) {
+    int ret = sys_io_uring_enter(ring_fd, sqe_tail - submitted, min_complete,
+                                 flags, argp, argsz);
+    if (ret >= 0) {
+      submitted += static_cast<unsigned>(ret);
+      return ret;
+    }
+
+    if (errno == EINTR)
+      continue;
+
+    return -errno;
+  }
+}
+
+int uring::register_resource(unsigned opcode, const void *arg,
+                             unsigned count) {
+  int ret = sys_io_uring_register(ring_fd, opcode, arg, count);
+  return ret < 0 ? -errno : ret;
+}
@@ -1,5 +1,7 @@
 #include "utils.hpp"
 
+#include <sys/socket.h>
+
 #include <cerrno>
 #include <exception>
 #include <stdexcept>
@@ -8,10 +10,25 @@
 using namespace utils;
 
 [[noreturn]] void utils::throw_sys_error(std::string msg) {
-  throw std::system_error(errno, std::system_category(), std::move(msg));
+  throw_sys_error(errno, std::move(msg));
+}
+
+[[noreturn]] void utils::throw_sys_error(int err, std::string msg) {
+  throw std::system_error(err, std::system_category(), std::move(msg));
 }
 
 std::exception_ptr utils::make_sys_error(std::string msg) {
+  return make_sys_error(errno, std::move(msg));
+}
+
+std::exception_ptr utils::make_sys_error(int err, std::string msg) {
   return std::make_exception_ptr(
-      std::system_error(errno, std::system_category(), std::move(msg)));
-}
\ No newline at end of file
+      std::system_error(err, std::system_category(), std::move(msg)));
+}
+
+bool utils::set_busy_poll(const handle &socket,
+                          std::chrono::microseconds duration) {
+  int value = static_cast<int>(duration.count());
+  return ::setsockopt(static_cast<int>(socket), SOL_SOCKET, SO_BUSY_POLL,
+                      &value, sizeof(value)) == 0;
+}